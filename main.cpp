@@ -5,6 +5,8 @@
 
 #include "tflow-control.hpp"
 
+#define TFLOW_CONTROL_SETTINGS_FILE "/etc/tflow/tflow-control.json"
+
 TFlowControl *gp_app;
 
 gboolean handle_signal(gpointer ctx)
@@ -17,22 +19,35 @@ gboolean handle_signal(gpointer ctx)
     return true;
 }
 
+gboolean handle_sighup(gpointer ctx)
+{
+    g_info("Got HUP signal, reloading TLS credentials...");
+
+    TFlowControl *app = (TFlowControl*)ctx;
+    app->tflow_mg->reloadTls();
+
+    return true;
+}
 
 static void setup_sig_handlers()
 {
-    GSource* src_sigint, * src_sigterm;
+    GSource* src_sigint, * src_sigterm, * src_sighup;
 
     src_sigint = g_unix_signal_source_new(SIGINT);
     src_sigterm = g_unix_signal_source_new(SIGTERM);
+    src_sighup = g_unix_signal_source_new(SIGHUP);
 
     g_source_set_callback(src_sigint, (GSourceFunc)handle_signal, gp_app, NULL);
     g_source_set_callback(src_sigterm, (GSourceFunc)handle_signal, gp_app, NULL);
+    g_source_set_callback(src_sighup, (GSourceFunc)handle_sighup, gp_app, NULL);
 
     g_source_attach(src_sigint, gp_app->context);
     g_source_attach(src_sigterm, gp_app->context);
+    g_source_attach(src_sighup, gp_app->context);
 
     g_source_unref(src_sigint);
     g_source_unref(src_sigterm);
+    g_source_unref(src_sighup);
 }
 
 int main(int argc, char** argv)
@@ -41,19 +56,14 @@ int main(int argc, char** argv)
 
     g_info("TFlow Control Started");
 
-    gp_app = new TFlowControl;
+    // tflow-control [settings.json]
+    gp_app = new TFlowControl(argc > 1 ? argv[1] : TFLOW_CONTROL_SETTINGS_FILE);
 
     setup_sig_handlers();
 
     // Block SIGPIPE signal
     signal(SIGPIPE, SIG_IGN);
 
-    gp_app->AttachIdle();
-
-#if CODE_BROWSE
-    gp_app->OnIdle();   
-#endif
-
     g_main_loop_run(gp_app->main_loop);
 
     delete gp_app;
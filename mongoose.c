@@ -2226,6 +2226,21 @@ struct mg_fs mg_fs_posix = {p_stat,  p_list, p_open,   p_close,  p_read,
 
 
 
+#ifndef MG_ENABLE_SENDFILE
+#if defined(__linux__) && MG_ENABLE_SOCKET && MG_ENABLE_POSIX_FS
+#define MG_ENABLE_SENDFILE 1
+#else
+#define MG_ENABLE_SENDFILE 0
+#endif
+#endif
+
+#if MG_ENABLE_SENDFILE
+#include <sys/sendfile.h>
+#ifndef MG_SENDFILE_MAX
+#define MG_SENDFILE_MAX (16UL * 1024UL * 1024UL)  // Per write readiness
+#endif
+#endif
+
 bool mg_to_size_t(struct mg_str str, size_t *val);
 bool mg_to_size_t(struct mg_str str, size_t *val) {
   size_t i = 0, max = (size_t) -1, max2 = max / 10, result = 0, ndigits = 0;
@@ -2652,6 +2667,7 @@ static void restore_http_cb(struct mg_connection *c) {
   c->pfn_data = NULL;
   c->pfn = http_cb;
   c->is_resp = 0;
+  c->is_sendfile = 0;
 }
 
 char *mg_http_etag(char *buf, size_t len, size_t size, time_t mtime);
@@ -2660,6 +2676,37 @@ char *mg_http_etag(char *buf, size_t len, size_t size, time_t mtime) {
   return buf;
 }
 
+#if MG_ENABLE_SENDFILE
+// File content goes from the page cache to the socket, not through c->send.
+// While c->is_sendfile is set, the socket is polled for writing even with
+// c->send empty, and each write readiness sends as much as fits.
+static void static_sendfile(struct mg_connection *c, struct mg_fd *fd,
+                            size_t *cl) {
+  int in = fileno((FILE *) fd->fd);
+  ssize_t n;
+  if (c->is_sendfile == 0) {
+    // Range requests seek the FILE, sendfile() goes by the descriptor offset
+    if (lseek(in, (off_t) ftell((FILE *) fd->fd), SEEK_SET) < 0) {
+      mg_error(c, "lseek: %d", errno);
+      return;
+    }
+    c->is_sendfile = 1;
+  }
+  n = sendfile((int) (size_t) c->fd, in, NULL,
+               *cl < MG_SENDFILE_MAX ? *cl : MG_SENDFILE_MAX);
+  if (n > 0) {
+    *cl -= (size_t) n;
+  } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+    mg_error(c, "sendfile: %d", errno);
+    return;
+  }
+  if (*cl == 0 || n == 0) {  // Done, or the file got shorter
+    MG_EPOLL_MOD(c, 0);
+    restore_http_cb(c);
+  }
+}
+#endif
+
 static void static_cb(struct mg_connection *c, int ev, void *ev_data) {
   if (ev == MG_EV_WRITE || ev == MG_EV_POLL) {
     struct mg_fd *fd = (struct mg_fd *) c->pfn_data;
@@ -2667,6 +2714,16 @@ static void static_cb(struct mg_connection *c, int ev, void *ev_data) {
     size_t n, max = MG_IO_SIZE, space;
     size_t *cl = (size_t *) &c->data[(sizeof(c->data) - sizeof(size_t)) /
                                      sizeof(size_t) * sizeof(size_t)];
+#if MG_ENABLE_SENDFILE
+    // Plain socket, or the kernel does TLS: let it send the file once the
+    // headers are out. An HTTPS connection learns that after the first send
+    if (fd->fs == &mg_fs_posix && (c->is_tls == 0 || c->is_ktls)) {
+      if (c->send.len == 0 && (c->is_writable || c->is_sendfile == 0)) {
+        static_sendfile(c, fd, cl);
+      }
+      return;
+    }
+#endif
     if (c->send.size < max) mg_iobuf_resize(&c->send, max);
     if (c->send.len >= c->send.size) return;  // Rate limit
     if ((space = c->send.size - c->send.len) > *cl) space = *cl;
@@ -3303,18 +3360,63 @@ struct mg_connection *mg_http_listen(struct mg_mgr *mgr, const char *url,
 
 
 
+#ifndef MG_ENABLE_IOBUF_REALLOC
+#if defined(__linux__)
+#define MG_ENABLE_IOBUF_REALLOC 1
+#else
+#define MG_ENABLE_IOBUF_REALLOC 0
+#endif
+#endif
+
+#ifndef MG_IOBUF_POOL_MAX
+#if defined(__linux__)
+#define MG_IOBUF_POOL_MAX 16  // Recycled buffers kept per manager, 0 - off
+#else
+#define MG_IOBUF_POOL_MAX 0
+#endif
+#endif
+
+#ifndef MG_IOBUF_POOL_SIZE
+#define MG_IOBUF_POOL_SIZE (64 * 1024)  // Bigger buffers are not recycled
+#endif
+
 static size_t roundup(size_t size, size_t align) {
   return align == 0 ? size : (size + align - 1) / align * align;
 }
 
 int mg_iobuf_resize(struct mg_iobuf *io, size_t new_size) {
   int ok = 1;
+#if MG_ENABLE_IOBUF_REALLOC
+  // Grow by half of the current size at least, so that appending to a large
+  // buffer piece by piece does not copy it over and over again
+  if (new_size > io->size && new_size < io->size + io->size / 2) {
+    new_size = io->size + io->size / 2;
+  }
+#endif
   new_size = roundup(new_size, io->align);
   if (new_size == 0) {
     mg_bzero(io->buf, io->size);
     free(io->buf);
     io->buf = NULL;
     io->len = io->size = 0;
+#if MG_ENABLE_IOBUF_REALLOC
+  } else if (new_size != io->size && io->buf != NULL) {
+    // realloc() extends in place when it can, and glibc uses mremap() for
+    // large buffers - no copying at all
+    void *p;
+    if (new_size < io->size) mg_bzero(io->buf + new_size, io->size - new_size);
+    if ((p = realloc(io->buf, new_size)) != NULL) {
+      if (new_size > io->size) {
+        memset((char *) p + io->size, 0, new_size - io->size);
+      }
+      io->buf = (unsigned char *) p;
+      io->size = new_size;
+      if (io->len > new_size) io->len = new_size;
+    } else {
+      ok = 0;
+      MG_ERROR(("%lld->%lld", (uint64_t) io->size, (uint64_t) new_size));
+    }
+#endif
   } else if (new_size != io->size) {
     // NOTE(lsm): do not use realloc here. Use calloc/free only, to ease the
     // porting to some obscure platforms like FreeRTOS
@@ -3344,8 +3446,16 @@ int mg_iobuf_init(struct mg_iobuf *io, size_t size, size_t align) {
 size_t mg_iobuf_add(struct mg_iobuf *io, size_t ofs, const void *buf,
                     size_t len) {
   size_t new_size = roundup(io->len + len, io->align);
-  mg_iobuf_resize(io, new_size);      // Attempt to resize
-  if (new_size != io->size) len = 0;  // Resize failure, append nothing
+#if MG_ENABLE_IOBUF_REALLOC
+  // Keep the capacity. Only buffers left far too big by a burst are shrunk
+  if (new_size > io->size ||
+      (io->size > MG_IOBUF_POOL_SIZE && new_size < io->size / 4)) {
+    mg_iobuf_resize(io, new_size);
+  }
+#else
+  mg_iobuf_resize(io, new_size);  // Attempt to resize
+#endif
+  if (new_size > io->size) len = 0;  // Resize failure, append nothing
   if (ofs < io->len) memmove(io->buf + ofs + len, io->buf + ofs, io->len - ofs);
   if (buf != NULL) memmove(io->buf + ofs, buf, len);
   if (ofs > io->len) io->len += ofs - io->len;
@@ -3366,6 +3476,44 @@ void mg_iobuf_free(struct mg_iobuf *io) {
   mg_iobuf_resize(io, 0);
 }
 
+// Connection buffers are recycled through a per-manager freelist, so that
+// short lived connections do not hit the allocator for every request
+struct iobuf_node {
+  struct iobuf_node *next;
+  size_t size;
+};
+
+void mg_iobuf_recycle(struct mg_mgr *mgr, struct mg_iobuf *io) {
+#if MG_IOBUF_POOL_MAX > 0
+  if (io->buf != NULL && mgr->niobufs < MG_IOBUF_POOL_MAX &&
+      io->size >= sizeof(struct iobuf_node) && io->size <= MG_IOBUF_POOL_SIZE) {
+    struct iobuf_node *n = (struct iobuf_node *) io->buf;
+    mg_bzero(io->buf, io->size);
+    n->next = (struct iobuf_node *) mgr->iobufs;
+    n->size = io->size;
+    mgr->iobufs = n;
+    mgr->niobufs++;
+    io->buf = NULL;
+    io->len = io->size = 0;
+    return;
+  }
+#endif
+  (void) mgr;
+  mg_iobuf_free(io);
+}
+
+void mg_iobuf_reuse(struct mg_mgr *mgr, struct mg_iobuf *io) {
+  struct iobuf_node *n = (struct iobuf_node *) mgr->iobufs;
+  if (io->buf == NULL && n != NULL) {
+    mgr->iobufs = n->next;
+    mgr->niobufs--;
+    io->buf = (unsigned char *) n;
+    io->size = n->size;
+    io->len = 0;
+    mg_bzero(io->buf, sizeof(*n));
+  }
+}
+
 #ifdef MG_ENABLE_LINES
 #line 1 "src/json.c"
 #endif
@@ -4570,6 +4718,7 @@ struct mg_connection *mg_mqtt_listen(struct mg_mgr *mgr, const char *url,
 
 size_t mg_vprintf(struct mg_connection *c, const char *fmt, va_list *ap) {
   size_t old = c->send.len;
+  mg_iobuf_reuse(c->mgr, &c->send);
   mg_vxprintf(mg_pfn_iobuf, &c->send, fmt, ap);
   return c->send.len - old;
 }
@@ -4713,9 +4862,9 @@ void mg_close_conn(struct mg_connection *c) {
   MG_PROF_FREE(c);
 
   mg_tls_free(c);
-  mg_iobuf_free(&c->recv);
-  mg_iobuf_free(&c->send);
-  mg_iobuf_free(&c->rtls);
+  mg_iobuf_recycle(c->mgr, &c->recv);
+  mg_iobuf_recycle(c->mgr, &c->send);
+  mg_iobuf_recycle(c->mgr, &c->rtls);
   mg_bzero((unsigned char *) c, sizeof(*c));
   free(c);
 }
@@ -4811,6 +4960,11 @@ void mg_mgr_free(struct mg_mgr *mgr) {
   if (mgr->epoll_fd >= 0) close(mgr->epoll_fd), mgr->epoll_fd = -1;
 #endif
   mg_tls_ctx_free(mgr);
+  while (mgr->iobufs != NULL) {
+    struct mg_iobuf io = {NULL, 0, 0, 0};
+    mg_iobuf_reuse(mgr, &io);
+    mg_iobuf_free(&io);
+  }
 }
 
 void mg_mgr_init(struct mg_mgr *mgr) {
@@ -6815,6 +6969,72 @@ static const uint32_t mg_sha256_k[64] = {
     0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
 
+// SHA-256, AES and GHASH kernels for x86 SHA-NI/AES-NI/PCLMULQDQ.
+// mg_hw_crypto has the kernels verified to match the C code at run time, see
+// mg_hw_crypto_init(). Until then the C code is used.
+#ifndef MG_ENABLE_HW_CRYPTO
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MG_ENABLE_HW_CRYPTO 1
+#else
+#define MG_ENABLE_HW_CRYPTO 0
+#endif
+#endif
+
+#if MG_ENABLE_HW_CRYPTO && !(defined(__GNUC__) && defined(__x86_64__))
+#error "MG_ENABLE_HW_CRYPTO: x86_64 with GCC or clang only"
+#endif
+
+#define MG_HW_AES 1U     // AES rounds
+#define MG_HW_CLMUL 2U   // carry-less multiply for GHASH
+#define MG_HW_SHA256 4U  // SHA-256 rounds
+
+#if MG_ENABLE_HW_CRYPTO
+static unsigned mg_hw_crypto;
+#endif
+
+#if MG_ENABLE_HW_CRYPTO && defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define MG_TARGET_AES __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+#define MG_TARGET_SHA __attribute__((target("sha,ssse3,sse4.1")))
+
+MG_TARGET_SHA static void mg_sha256_chunk_hw(uint32_t state[8],
+                                             const uint8_t data[64]) {
+  const __m128i bswap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bLL, 0x0405060700010203LL);
+  __m128i w[16], s0, s1, abef, cdgh, t;
+  int i;
+  // State words go in as ABEF and CDGH
+  t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xB1);
+  s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1B);
+  s0 = _mm_alignr_epi8(t, s1, 8);
+  s1 = _mm_blend_epi16(s1, t, 0xF0);
+  abef = s0;
+  cdgh = s1;
+  for (i = 0; i < 4; i++) {
+    w[i] = _mm_shuffle_epi8(
+        _mm_loadu_si128((const __m128i *) (data + i * 16)), bswap);
+  }
+  for (i = 4; i < 16; i++) {
+    t = _mm_sha256msg1_epu32(w[i - 4], w[i - 3]);
+    t = _mm_add_epi32(t, _mm_alignr_epi8(w[i - 1], w[i - 2], 4));
+    w[i] = _mm_sha256msg2_epu32(t, w[i - 1]);
+  }
+  for (i = 0; i < 16; i++) {
+    t = _mm_add_epi32(
+        w[i], _mm_loadu_si128((const __m128i *) &mg_sha256_k[i * 4]));
+    s1 = _mm_sha256rnds2_epu32(s1, s0, t);
+    s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(t, 0x0E));
+  }
+  s0 = _mm_add_epi32(s0, abef);
+  s1 = _mm_add_epi32(s1, cdgh);
+  t = _mm_shuffle_epi32(s0, 0x1B);
+  s1 = _mm_shuffle_epi32(s1, 0xB1);
+  _mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(t, s1, 0xF0));
+  _mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(s1, t, 8));
+}
+#endif
+
 void mg_sha256_init(mg_sha256_ctx *ctx) {
   ctx->len = 0;
   ctx->bits = 0;
@@ -6832,6 +7052,12 @@ static void mg_sha256_chunk(mg_sha256_ctx *ctx) {
   int i, j;
   uint32_t a, b, c, d, e, f, g, h;
   uint32_t m[64];
+#if MG_ENABLE_HW_CRYPTO
+  if (mg_hw_crypto & MG_HW_SHA256) {
+    mg_sha256_chunk_hw(ctx->state, ctx->buffer);
+    return;
+  }
+#endif
   for (i = 0, j = 0; i < 16; ++i, j += 4)
     m[i] = (uint32_t) ((ctx->buffer[j] << 24) | (ctx->buffer[j + 1] << 16) |
                        (ctx->buffer[j + 2] << 8) | (ctx->buffer[j + 3]));
@@ -7185,6 +7411,7 @@ bool mg_send(struct mg_connection *c, const void *buf, size_t len) {
     iolog(c, (char *) buf, n, false);
     return n > 0;
   } else {
+    mg_iobuf_reuse(c->mgr, &c->send);
     return mg_iobuf_add(&c->send, c->send.len, buf, len);
   }
 }
@@ -7220,9 +7447,48 @@ static void mg_set_non_blocking_mode(MG_SOCKET_TYPE fd) {
 #endif
 }
 
+#if MG_ARCH == MG_ARCH_UNIX
+#include <sys/un.h>
+
+// "unix:/path" or "unix:///path"
+static bool mg_open_unix_listener(struct mg_connection *c, const char *path) {
+  MG_SOCKET_TYPE fd = MG_INVALID_SOCKET;
+  struct sockaddr_un sun;
+  struct stat st;
+  if (strncmp(path, "//", 2) == 0) path += 2;
+  if (strlen(path) >= sizeof(sun.sun_path)) {
+    MG_ERROR(("unix socket path is too long: %s", path));
+    return false;
+  }
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+  // remove a stale socket left by the previous run
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == MG_INVALID_SOCKET) {
+    MG_ERROR(("socket: %d", MG_SOCK_ERR(-1)));
+    return false;
+  }
+  if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) != 0 ||
+      listen(fd, MG_SOCK_LISTEN_BACKLOG_SIZE) != 0) {
+    MG_ERROR(("bind/listen %s: %d", path, MG_SOCK_ERR(-1)));
+    closesocket(fd);
+    return false;
+  }
+  mg_set_non_blocking_mode(fd);
+  c->fd = S2PTR(fd);
+  MG_EPOLL_ADD(c);
+  return true;
+}
+#endif
+
 bool mg_open_listener(struct mg_connection *c, const char *url) {
   MG_SOCKET_TYPE fd = MG_INVALID_SOCKET;
   bool success = false;
+#if MG_ARCH == MG_ARCH_UNIX
+  if (strncmp(url, "unix:", 5) == 0) return mg_open_unix_listener(c, url + 5);
+#endif
   c->loc.port = mg_htons(mg_url_port(url));
   if (!mg_aton(mg_url_host(url), &c->loc)) {
     MG_ERROR(("invalid listening URL: %s", url));
@@ -7300,6 +7566,7 @@ static long recv_raw(struct mg_connection *c, void *buf, size_t len) {
 
 static bool ioalloc(struct mg_connection *c, struct mg_iobuf *io) {
   bool res = false;
+  mg_iobuf_reuse(c->mgr, io);
   if (io->len >= MG_MAX_RECV_SIZE) {
     mg_error(c, "MG_MAX_RECV_SIZE");
   } else if (io->size <= io->len &&
@@ -7490,7 +7757,8 @@ static bool can_read(const struct mg_connection *c) {
 }
 
 static bool can_write(const struct mg_connection *c) {
-  return c->is_connecting || (c->send.len > 0 && c->is_tls_hs == 0);
+  return c->is_connecting ||
+         ((c->send.len > 0 || c->is_sendfile) && c->is_tls_hs == 0);
 }
 
 static bool skip_iotest(const struct mg_connection *c) {
@@ -7711,8 +7979,8 @@ bool mg_wakeup(struct mg_mgr *mgr, unsigned long conn_id, const void *buf,
     char *extended_buf = (char *) alloca(len + sizeof(conn_id));
     memcpy(extended_buf, &conn_id, sizeof(conn_id));
     memcpy(extended_buf + sizeof(conn_id), buf, len);
-    send(mgr->pipe, extended_buf, len + sizeof(conn_id), MSG_NONBLOCKING);
-    return true;
+    return send(mgr->pipe, extended_buf, len + sizeof(conn_id),
+                MSG_NONBLOCKING) > 0;  // Datagram may be lost when full
   }
   return false;
 }
@@ -7747,7 +8015,7 @@ void mg_mgr_poll(struct mg_mgr *mgr, int ms) {
       //  if ((c->is_readable || c->is_writable)) mg_tls_handshake(c);
     } else {
       if (c->is_readable) read_conn(c);
-      if (c->is_writable) write_conn(c);
+      if (c->is_writable && c->send.len > 0) write_conn(c);  // or sendfile
     }
 
     if (c->is_draining && c->send.len == 0) c->is_closing = 1;
@@ -8469,6 +8737,44 @@ int aes_setkey(aes_context *ctx,  // AES context provided by our caller
     return (aes_set_encryption_key(ctx, key, keysize));
 }
 
+#if MG_ENABLE_HW_CRYPTO && defined(__x86_64__)
+// Round keys are kept as little-endian words, i.e. in their byte order
+MG_TARGET_AES static void aes_cipher_hw(const uint32_t *rk, int rounds,
+                                        const uchar input[16],
+                                        uchar output[16]) {
+  __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) input),
+                            _mm_loadu_si128((const __m128i *) rk));
+  int i;
+  for (i = 1; i < rounds; i++) {
+    b = _mm_aesenc_si128(b, _mm_loadu_si128((const __m128i *) (rk + i * 4)));
+  }
+  b = _mm_aesenclast_si128(
+      b, _mm_loadu_si128((const __m128i *) (rk + rounds * 4)));
+  _mm_storeu_si128((__m128i *) output, b);
+}
+
+// Four independent blocks keep the AES unit busy, for counter mode
+MG_TARGET_AES static void aes_cipher4_hw(const uint32_t *rk, int rounds,
+                                         const uchar input[64],
+                                         uchar output[64]) {
+  __m128i k = _mm_loadu_si128((const __m128i *) rk), b[4];
+  int i, j;
+  for (j = 0; j < 4; j++) {
+    b[j] = _mm_xor_si128(
+        _mm_loadu_si128((const __m128i *) (input + j * 16)), k);
+  }
+  for (i = 1; i < rounds; i++) {
+    k = _mm_loadu_si128((const __m128i *) (rk + i * 4));
+    for (j = 0; j < 4; j++) b[j] = _mm_aesenc_si128(b[j], k);
+  }
+  k = _mm_loadu_si128((const __m128i *) (rk + rounds * 4));
+  for (j = 0; j < 4; j++) {
+    _mm_storeu_si128((__m128i *) (output + j * 16),
+                     _mm_aesenclast_si128(b[j], k));
+  }
+}
+#endif
+
 /******************************************************************************
  *
  *  AES_CIPHER
@@ -8482,6 +8788,13 @@ int aes_cipher(aes_context *ctx, const uchar input[16], uchar output[16]) {
   int i;
   uint32_t *RK, X0, X1, X2, X3, Y0, Y1, Y2, Y3;  // general purpose locals
 
+#if MG_ENABLE_HW_CRYPTO
+  if ((mg_hw_crypto & MG_HW_AES) && ctx->mode == ENCRYPT) {
+    aes_cipher_hw(ctx->rk, ctx->rounds, input, output);
+    return (0);
+  }
+#endif
+
   RK = ctx->rk;
 
   GET_UINT32_LE(X0, input, 0);
@@ -8674,11 +8987,125 @@ static const uint64_t last4[16] = {
  *  environment is running.
  *
  ******************************************************************************/
+#if MG_ENABLE_HW_CRYPTO
+static void mg_hw_crypto_init(void);
+#endif
+
 int gcm_initialize(void) {
   aes_init_keygen_tables();
+#if MG_ENABLE_HW_CRYPTO
+  mg_hw_crypto_init();
+#endif
   return (0);
 }
 
+#if MG_ENABLE_HW_CRYPTO
+/*
+ *  With the bits of every byte reversed, GHASH operands are plain polynomials
+ *  with bit i being x^i, so the product is four 64x64 carry-less multiplies
+ *  and is reduced modulo x^128 + x^7 + x^2 + x + 1 by folding the upper
+ *  words back with x^128 = x^7 + x^2 + x + 1 (0x87).
+ */
+MG_TARGET_AES static __m128i gcm_rbit_hw(__m128i x) {
+  const __m128i rev = _mm_set_epi8(15, 7, 11, 3, 13, 5, 9, 1, 14, 6, 10, 2,
+                                   12, 4, 8, 0);
+  const __m128i lo4 = _mm_set1_epi8(0x0f);
+  __m128i lo = _mm_shuffle_epi8(rev, _mm_and_si128(x, lo4));
+  __m128i hi = _mm_shuffle_epi8(rev, _mm_and_si128(_mm_srli_epi16(x, 4), lo4));
+  return _mm_or_si128(_mm_slli_epi16(lo, 4), hi);
+}
+
+MG_TARGET_AES static void gcm_gfmul_hw(const uint64_t a[2],
+                                       const uint64_t b[2], uint64_t r[2]) {
+  __m128i x = _mm_loadu_si128((const __m128i *) a);
+  __m128i y = _mm_loadu_si128((const __m128i *) b);
+  __m128i poly = _mm_cvtsi32_si128(0x87);
+  __m128i lo = _mm_clmulepi64_si128(x, y, 0x00);
+  __m128i hi = _mm_clmulepi64_si128(x, y, 0x11);
+  __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(x, y, 0x01),
+                              _mm_clmulepi64_si128(x, y, 0x10));
+  lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+  mid = _mm_clmulepi64_si128(hi, poly, 0x01);  // x^192 = 0x87 * x^64
+  lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+  lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(hi, poly, 0x00));  // x^128
+  _mm_storeu_si128((__m128i *) r, lo);
+}
+
+MG_TARGET_AES static void gcm_load_hw(const uchar x[16], uint64_t w[2]) {
+  _mm_storeu_si128((__m128i *) w,
+                   gcm_rbit_hw(_mm_loadu_si128((const __m128i *) x)));
+}
+
+MG_TARGET_AES static void gcm_store_hw(const uint64_t w[2], uchar x[16]) {
+  _mm_storeu_si128((__m128i *) x,
+                   gcm_rbit_hw(_mm_loadu_si128((const __m128i *) w)));
+}
+
+MG_TARGET_AES static void gcm_hkey_hw(const gcm_context *ctx, uint64_t h[2]) {
+  uchar b[16];
+  PUT_UINT32_BE(ctx->HH[8] >> 32, b, 0);  // H, see gcm_setkey()
+  PUT_UINT32_BE(ctx->HH[8], b, 4);
+  PUT_UINT32_BE(ctx->HL[8] >> 32, b, 8);
+  PUT_UINT32_BE(ctx->HL[8], b, 12);
+  gcm_load_hw(b, h);
+}
+
+MG_TARGET_AES static void gcm_mult_hw(gcm_context *ctx, const uchar x[16],
+                                      uchar output[16]) {
+  uint64_t a[2], h[2];
+  gcm_hkey_hw(ctx, h);
+  gcm_load_hw(x, a);
+  gcm_gfmul_hw(a, h, a);
+  gcm_store_hw(a, output);
+}
+
+/*
+ *  GCM_UPDATE for whole blocks, counter blocks are encrypted four at a time.
+ *  The GHASH value stays bit reversed until the last block. Returns the
+ *  number of bytes processed, a partial block is left to gcm_update().
+ */
+MG_TARGET_AES static size_t gcm_update_hw(gcm_context *ctx, size_t length,
+                                          const uchar *input, uchar *output) {
+  uchar ctr[64], ectr[64];
+  uint64_t h[2], y[2], c[2], d[2], e[2];
+  size_t done = 0, n, i, j;
+
+  gcm_hkey_hw(ctx, h);
+  gcm_load_hw(ctx->buf, y);
+  while (length - done >= 16) {
+    n = (length - done) / 16;
+    if (n > 4) n = 4;
+    for (j = 0; j < 4; j++) {
+      memcpy(ctr + j * 16, j ? ctr + (j - 1) * 16 : ctx->y, 16);
+      for (i = 16; i > 12; i--)
+        if (++ctr[j * 16 + i - 1] != 0) break;
+    }
+    memcpy(ctx->y, ctr + (n - 1) * 16, 16);
+    aes_cipher4_hw(ctx->aes_ctx.rk, ctx->aes_ctx.rounds, ctr, ectr);
+
+    for (j = 0; j < n; j++, done += 16) {
+      const uchar *p = input + done;
+      uchar *q = output + done;
+      // GHASH is over the ciphertext, read it before in-place decryption
+      if (ctx->mode != ENCRYPT) gcm_load_hw(p, c);
+      memcpy(d, p, 16);
+      memcpy(e, ectr + j * 16, 16);
+      d[0] ^= e[0];
+      d[1] ^= e[1];
+      memcpy(q, d, 16);
+      if (ctx->mode == ENCRYPT) gcm_load_hw(q, c);
+      y[0] ^= c[0];
+      y[1] ^= c[1];
+      gcm_gfmul_hw(y, h, y);
+    }
+  }
+  gcm_store_hw(y, ctx->buf);
+  return done;
+}
+#endif
+
 /******************************************************************************
  *
  *  GCM_MULT
@@ -8696,6 +9123,13 @@ static void gcm_mult(gcm_context *ctx,   // pointer to established context
   uchar lo, hi, rem;
   uint64_t zh, zl;
 
+#if MG_ENABLE_HW_CRYPTO
+  if (mg_hw_crypto & MG_HW_CLMUL) {
+    gcm_mult_hw(ctx, x, output);
+    return;
+  }
+#endif
+
   lo = (uchar) (x[15] & 0x0f);
   hi = (uchar) (x[15] >> 4);
   zh = ctx->HH[lo];
@@ -8785,6 +9219,101 @@ int gcm_setkey(gcm_context *ctx,    // pointer to caller-provided gcm context
   return (0);
 }
 
+
+#if MG_ENABLE_HW_CRYPTO
+static unsigned mg_cpu_features(void) {
+  unsigned f = 0;
+  unsigned a, b, c, d;
+  if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3) && (c & bit_SSE4_1)) {
+    if (c & bit_AES) f |= MG_HW_AES;
+    if (c & bit_PCLMUL) f |= MG_HW_CLMUL;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1U << 29)))
+      f |= MG_HW_SHA256;  // CPUID.7.0:EBX.SHA
+  }
+  return f;
+}
+
+/******************************************************************************
+ *
+ *  MG_HW_CRYPTO_INIT
+ *
+ *  Enables the kernels the CPU supports, each only once it produces the same
+ *  output as the C code: the FIPS-197 C.1 AES-128 and the FIPS 180-2 "abc"
+ *  SHA-256 vectors, GHASH against gcm_mult() over a chain of products.
+ *  Runs once, from gcm_initialize().
+ *
+ ******************************************************************************/
+static void mg_hw_crypto_init(void) {
+  static bool done = false;
+  static const uchar key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                0x0c, 0x0d, 0x0e, 0x0f};
+  static const uchar pt[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                               0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+                               0xcc, 0xdd, 0xee, 0xff};
+  static const uchar ct[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b,
+                               0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80,
+                               0x70, 0xb4, 0xc5, 0x5a};
+  static const uint32_t abc[8] = {0xba7816bf, 0x8f01cfea, 0x414140de,
+                                  0x5dae2223, 0xb00361a3, 0x96177a9c,
+                                  0xb410ff61, 0xf20015ad};
+  unsigned f;
+  int i;
+
+  if (done) return;
+  done = true;
+  f = mg_cpu_features();
+
+  if (f & MG_HW_AES) {
+    aes_context aes;
+    uchar out[16];
+    aes_setkey(&aes, ENCRYPT, key, sizeof(key));
+    aes_cipher_hw(aes.buf, aes.rounds, pt, out);
+    if (memcmp(out, ct, sizeof(ct)) == 0) {
+      mg_hw_crypto |= MG_HW_AES;
+    } else {
+      MG_ERROR(("AES kernel mismatch"));
+    }
+  }
+  if (f & MG_HW_CLMUL) {
+    gcm_context gcm;
+    uchar x[16], y[16], z[16];
+    bool ok = true;
+    gcm_setkey(&gcm, key, sizeof(key));
+    memcpy(x, ct, sizeof(x));
+    for (i = 0; i < 16 && ok; i++) {
+      gcm_mult(&gcm, x, y);
+      gcm_mult_hw(&gcm, x, z);
+      ok = memcmp(y, z, sizeof(y)) == 0;
+      y[i] ^= pt[i];  // keep a few high and low bits set
+      memcpy(x, y, sizeof(x));
+    }
+    gcm_zero_ctx(&gcm);
+    if (ok) {
+      mg_hw_crypto |= MG_HW_CLMUL;
+    } else {
+      MG_ERROR(("GHASH kernel mismatch"));
+    }
+  }
+  if (f & MG_HW_SHA256) {
+    mg_sha256_ctx sha;
+    mg_sha256_init(&sha);
+    memset(sha.buffer, 0, sizeof(sha.buffer));
+    memcpy(sha.buffer, "abc\x80", 4);
+    sha.buffer[63] = 24;  // length in bits
+    mg_sha256_chunk_hw(sha.state, sha.buffer);
+    if (memcmp(sha.state, abc, sizeof(abc)) == 0) {
+      mg_hw_crypto |= MG_HW_SHA256;
+    } else {
+      MG_ERROR(("SHA-256 kernel mismatch"));
+    }
+  }
+  MG_INFO(("HW crypto:%s%s%s", (mg_hw_crypto & MG_HW_AES) ? " AES" : "",
+           (mg_hw_crypto & MG_HW_CLMUL) ? " GHASH" : "",
+           (mg_hw_crypto & MG_HW_SHA256) ? " SHA-256" : ""));
+}
+#endif
+
 /******************************************************************************
  *
  *    GCM processing occurs four phases: SETKEY, START, UPDATE and FINISH.
@@ -8886,6 +9415,16 @@ int gcm_update(gcm_context *ctx,    // pointer to user-provided GCM context
 
   ctx->len += length;  // bump the GCM context's running length count
 
+#if MG_ENABLE_HW_CRYPTO
+  if ((mg_hw_crypto & (MG_HW_AES | MG_HW_CLMUL)) ==
+      (MG_HW_AES | MG_HW_CLMUL)) {
+    size_t n = gcm_update_hw(ctx, length, input, output);
+    length -= n;
+    input += n;
+    output += n;
+  }
+#endif
+
   while (length > 0) {
     // clamp the length to process at 16 bytes
     use_len = (length < 16) ? length : 16;
@@ -9137,6 +9676,12 @@ struct tls_data {
 
   uint32_t sseq;  // server sequence number, used in encryption
   uint32_t cseq;  // client sequence number, used in decryption
+  size_t recv_offset;  // decrypted application data not yet handed out,
+  size_t recv_len;     // kept in place in c->rtls
+  size_t send_plain;   // c->send bytes already encrypted into tls->send
+
+  bool ktls_wanted;  // hand the server key to the kernel once idle, then
+                     // c->is_ktls is set
 
   uint8_t session_id[32];  // client session ID between the handshake states
   uint8_t x25519_cli[32];  // client X25519 key between the handshake states
@@ -9145,6 +9690,10 @@ struct tls_data {
   struct mg_str server_cert_der;  // server certificate in DER format
   uint8_t server_key[32];         // server EC private key
 
+  bool resumed;               // session is resumed with a ticket (PSK)
+  uint8_t early_secret[32];   // PSK based if resumed
+  uint8_t master_secret[32];  // to derive resumption secret for a new ticket
+
   // keys for AES encryption
   uint8_t handshake_secret[32];
   uint8_t server_write_key[16];
@@ -9153,6 +9702,53 @@ struct tls_data {
   uint8_t client_write_key[16];
   uint8_t client_write_iv[12];
   uint8_t client_finished_key[32];
+
+  // AES key schedule and GHASH tables, expanded once per traffic key
+  gcm_context server_gcm;
+  gcm_context client_gcm;
+};
+
+// Linux kernel TLS: after the handshake the kernel encrypts sent records, so
+// the data goes out with plain send() from c->send. Receiving stays here.
+#ifndef MG_ENABLE_KTLS
+#if defined(__linux__) && MG_ENABLE_SOCKET && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#define MG_ENABLE_KTLS 1
+#endif
+#endif
+#endif
+#ifndef MG_ENABLE_KTLS
+#define MG_ENABLE_KTLS 0
+#endif
+
+#if MG_ENABLE_KTLS
+#include <linux/tls.h>
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+// Session tickets (RFC8446 4.6.1). Tickets are opaque IDs of PSKs kept by
+// the server, shared by all connections of the manager.
+#ifndef MG_TLS_TICKETS
+#define MG_TLS_TICKETS 32
+#endif
+#ifndef MG_TLS_TICKET_LIFETIME
+#define MG_TLS_TICKET_LIFETIME 7200  // seconds
+#endif
+
+struct mg_tls_ticket {
+  uint8_t id[16];
+  uint8_t psk[32];
+  uint64_t expire;  // mg_millis()
+};
+
+struct mg_tls_tickets {
+  struct mg_tls_ticket tickets[MG_TLS_TICKETS];
+  size_t next;  // oldest ticket, replaced first
 };
 
 #define MG_LOAD_BE16(p) ((uint16_t) ((MG_U8P(p)[0] << 8U) | MG_U8P(p)[1]))
@@ -9437,6 +10033,65 @@ static void mg_tls_drop_packet(struct mg_iobuf *rio) {
   mg_iobuf_del(rio, 0, n);
 }
 
+// check the PSK offered in ClientHello. Only the first identity is tried.
+// hello points to the handshake message, psk to pre_shared_key extension data
+static void mg_tls_accept_psk(struct mg_connection *c, uint8_t *hello,
+                              uint8_t *psk, uint16_t psk_len) {
+  struct tls_data *tls = c->tls;
+  struct mg_tls_tickets *tt = (struct mg_tls_tickets *) c->mgr->tls_ctx;
+  struct mg_tls_ticket *t = NULL;
+  uint16_t ids_len;
+  uint8_t *binders;
+  uint8_t early_secret[32], binder_key[32], finished_key[32];
+  uint8_t hash[32], binder[32];
+  mg_sha256_ctx sha256;
+  size_t i;
+  int diff;
+
+  if (tt == NULL || psk_len < 2) return;
+  ids_len = MG_LOAD_BE16(psk);
+  // identities: [len 2][identity 16][age 4] ..., binders: [len 2][len 1][32]
+  if (ids_len < 22 || (size_t) ids_len + 2 + 3 + 32 > psk_len) return;
+  if (MG_LOAD_BE16(psk + 2) != sizeof(t->id)) return;  // not our ticket
+  binders = psk + 2 + ids_len;
+  if (binders[2] != sizeof(binder)) return;
+
+  for (i = 0; i < MG_TLS_TICKETS; i++) {
+    if (memcmp(tt->tickets[i].id, psk + 4, sizeof(t->id)) == 0 &&
+        tt->tickets[i].expire > mg_millis()) {
+      t = &tt->tickets[i];
+      break;
+    }
+  }
+  if (t == NULL) {
+    MG_DEBUG(("%lu unknown or expired ticket", c->id));
+    return;
+  }
+
+  // binder is HMAC over ClientHello truncated before the binders list
+  mg_hmac_sha256(early_secret, NULL, 0, t->psk, sizeof(t->psk));
+  mg_tls_derive_secret("tls13 res binder", early_secret, 32,
+                       zeros_sha256_digest, 32, binder_key, 32);
+  mg_tls_derive_secret("tls13 finished", binder_key, 32, NULL, 0,
+                       finished_key, 32);
+  mg_sha256_init(&sha256);
+  mg_sha256_update(&sha256, hello, (size_t) (binders - hello));
+  mg_sha256_final(hash, &sha256);
+  mg_hmac_sha256(binder, finished_key, 32, hash, 32);
+  // compare in constant time, like the GCM tag
+  for (diff = 0, i = 0; i < sizeof(binder); i++) {
+    diff |= binder[i] ^ binders[3 + i];
+  }
+  if (diff != 0) {
+    MG_INFO(("%lu bad PSK binder", c->id));
+    return;
+  }
+
+  memmove(tls->early_secret, early_secret, sizeof(early_secret));
+  tls->resumed = true;
+  MG_DEBUG(("%lu session resumed", c->id));
+}
+
 // read and parse ClientHello record
 static int mg_tls_client_hello(struct mg_connection *c) {
   struct tls_data *tls = c->tls;
@@ -9445,7 +10100,10 @@ static int mg_tls_client_hello(struct mg_connection *c) {
   uint16_t j;
   uint16_t cipher_suites_len;
   uint16_t ext_len;
-  uint8_t *ext;
+  uint8_t *ext, *end;
+  bool key_share = false, psk_dhe_ke = false;
+  uint8_t *psk = NULL;
+  uint16_t psk_len = 0;
 
   if (!mg_tls_got_msg(c)) {
     return MG_IO_WAIT;
@@ -9454,7 +10112,15 @@ static int mg_tls_client_hello(struct mg_connection *c) {
     mg_error(c, "not a hello packet");
     return -1;
   }
-  mg_sha256_update(&tls->sha256, rio->buf + 5, rio->len - 5);
+  // all lengths below come from the peer - keep them inside the record
+  end = rio->buf + TLS_HDR_SIZE + MG_LOAD_BE16(rio->buf + 3);
+  if (end < rio->buf + 50 || end < rio->buf + 50 + rio->buf[43] ||
+      end < rio->buf + 50 + rio->buf[43] +
+                MG_LOAD_BE16(rio->buf + 44 + rio->buf[43])) {
+    mg_error(c, "bad client hello");
+    return -1;
+  }
+  mg_sha256_update(&tls->sha256, rio->buf + 5, MG_LOAD_BE16(rio->buf + 3));
   session_id_len = rio->buf[43];
   if (session_id_len == sizeof(tls->session_id)) {
     memmove(tls->session_id, rio->buf + 44, session_id_len);
@@ -9464,31 +10130,57 @@ static int mg_tls_client_hello(struct mg_connection *c) {
   cipher_suites_len = MG_LOAD_BE16(rio->buf + 44 + session_id_len);
   ext_len = MG_LOAD_BE16(rio->buf + 48 + session_id_len + cipher_suites_len);
   ext = rio->buf + 50 + session_id_len + cipher_suites_len;
-  for (j = 0; j < ext_len;) {
+  if (ext + ext_len > end) {
+    mg_error(c, "bad client hello");
+    return -1;
+  }
+  for (j = 0; j + 4 <= ext_len;) {
     uint16_t k;
     uint16_t key_exchange_len;
     uint8_t *key_exchange;
+    uint16_t type = MG_LOAD_BE16(ext + j);
     uint16_t n = MG_LOAD_BE16(ext + j + 2);
-    if (ext[j] != 0x00 ||
-        ext[j + 1] != 0x33) {  // not a key share extension, ignore
-      j += (uint16_t) (n + 4);
-      continue;
+    if ((size_t) j + 4 + n > ext_len ||
+        (type == 0x29 && (size_t) j + 4 + n != ext_len)) {
+      mg_error(c, "bad client hello");  // overruns, or PSK is not the last
+      return -1;
     }
-    key_exchange_len = MG_LOAD_BE16(ext + j + 5);
-    key_exchange = ext + j + 6;
-    for (k = 0; k < key_exchange_len;) {
-      uint16_t m = MG_LOAD_BE16(key_exchange + k + 2);
-      if (m == 32 && key_exchange[k] == 0x00 && key_exchange[k + 1] == 0x1d) {
-        memmove(tls->x25519_cli, key_exchange + k + 4, m);
-        mg_tls_drop_packet(rio);
-        return 0;
+    if (type == 0x2d && n > 0) {  // psk_key_exchange_modes
+      for (k = 1; k < n && k <= ext[j + 4]; k++) {
+        if (ext[j + 4 + k] == 1) psk_dhe_ke = true;
+      }
+    } else if (type == 0x29) {  // pre_shared_key, always the last one
+      psk = ext + j + 4;
+      psk_len = n;
+    } else if (type == 0x33 && !key_share && n >= 2) {  // key share
+      key_exchange_len = MG_LOAD_BE16(ext + j + 4);
+      key_exchange = ext + j + 6;
+      if (key_exchange_len > n - 2) key_exchange_len = (uint16_t) (n - 2);
+      for (k = 0; k + 4 <= key_exchange_len;) {
+        uint16_t m = MG_LOAD_BE16(key_exchange + k + 2);
+        if (k + 4 + m > key_exchange_len) break;
+        if (m == 32 && key_exchange[k] == 0x00 && key_exchange[k + 1] == 0x1d) {
+          memmove(tls->x25519_cli, key_exchange + k + 4, m);
+          key_share = true;
+          break;
+        }
+        k += (uint16_t) (m + 4);
       }
-      k += (uint16_t) (m + 4);
     }
     j += (uint16_t) (n + 4);
   }
-  mg_error(c, "bad client hello");
-  return -1;
+  if (!key_share) {
+    mg_error(c, "bad client hello");
+    return -1;
+  }
+
+  // resumption keeps (EC)DHE key exchange - psk_dhe_ke mode only
+  mg_hmac_sha256(tls->early_secret, NULL, 0, zeros, sizeof(zeros));
+  if (psk != NULL && psk_dhe_ke) {
+    mg_tls_accept_psk(c, rio->buf + 5, psk, psk_len);
+  }
+  mg_tls_drop_packet(rio);
+  return 0;
 }
 
 // put ServerHello record into wio buffer
@@ -9496,7 +10188,7 @@ static void mg_tls_server_hello(struct mg_connection *c) {
   struct tls_data *tls = c->tls;
   struct mg_iobuf *wio = &tls->send;
 
-  uint8_t msg_server_hello[122] =
+  uint8_t msg_server_hello[128] =
       // server hello, tls 1.2
       "\x02\x00\x00\x76\x03\x03"
       // random (32 bytes)
@@ -9529,14 +10221,26 @@ static void mg_tls_server_hello(struct mg_connection *c) {
   x25519(tls->x25519_sec, x25519_prv, tls->x25519_cli, 1);
   mg_tls_hexdump("x25519 sec", tls->x25519_sec, sizeof(tls->x25519_sec));
 
+  size_t n = 122;
+  uint8_t hdr[5] = {0x16, 0x03, 0x03, 0x00, 0x00};
+
   // fill in the gaps: session ID + keyshare
   memmove(msg_server_hello + 39, tls->session_id, sizeof(tls->session_id));
   memmove(msg_server_hello + 84, x25519_pub, sizeof(x25519_pub));
 
+  // pre_shared_key extension, selected identity 0
+  if (tls->resumed) {
+    memmove(msg_server_hello + n, "\x00\x29\x00\x02\x00\x00", 6);
+    n += 6;
+    msg_server_hello[3] = (uint8_t) (n - 4);
+    msg_server_hello[75] = (uint8_t) (n - 76);
+  }
+  hdr[4] = (uint8_t) n;
+
   // server hello message
-  mg_iobuf_add(wio, wio->len, "\x16\x03\x03\x00\x7a", 5);
-  mg_iobuf_add(wio, wio->len, msg_server_hello, sizeof(msg_server_hello));
-  mg_sha256_update(&tls->sha256, msg_server_hello, sizeof(msg_server_hello));
+  mg_iobuf_add(wio, wio->len, hdr, sizeof(hdr));
+  mg_iobuf_add(wio, wio->len, msg_server_hello, n);
+  mg_sha256_update(&tls->sha256, msg_server_hello, n);
 
   // change cipher message
   mg_iobuf_add(wio, wio->len, "\x14\x03\x03\x00\x01\x01", 6);
@@ -9544,19 +10248,25 @@ static void mg_tls_server_hello(struct mg_connection *c) {
 
 // at this point we have x25519 shared secret, we can generate a set of derived
 // handshake encryption keys
+// expand AES/GCM contexts of the current traffic keys for all the records
+static void mg_tls_expand_keys(struct tls_data *tls) {
+  gcm_setkey(&tls->server_gcm, tls->server_write_key,
+             sizeof(tls->server_write_key));
+  gcm_setkey(&tls->client_gcm, tls->client_write_key,
+             sizeof(tls->client_write_key));
+}
+
 static void mg_tls_generate_handshake_keys(struct mg_connection *c) {
   struct tls_data *tls = c->tls;
 
   mg_sha256_ctx sha256;
-  uint8_t early_secret[32];
   uint8_t pre_extract_secret[32];
   uint8_t hello_hash[32];
   uint8_t server_hs_secret[32];
   uint8_t client_hs_secret[32];
 
-  mg_hmac_sha256(early_secret, NULL, 0, zeros, sizeof(zeros));
-  mg_tls_derive_secret("tls13 derived", early_secret, 32, zeros_sha256_digest,
-                       32, pre_extract_secret, 32);
+  mg_tls_derive_secret("tls13 derived", tls->early_secret, 32,
+                       zeros_sha256_digest, 32, pre_extract_secret, 32);
   mg_hmac_sha256(tls->handshake_secret, pre_extract_secret,
                  sizeof(pre_extract_secret), tls->x25519_sec,
                  sizeof(tls->x25519_sec));
@@ -9586,6 +10296,7 @@ static void mg_tls_generate_handshake_keys(struct mg_connection *c) {
                        tls->client_write_iv, 12);
   mg_tls_derive_secret("tls13 finished", client_hs_secret, 32, NULL, 0,
                        tls->client_finished_key, 32);
+  mg_tls_expand_keys(tls);
 }
 
 // AES GCM encryption of the message + put encoded data into the write buffer
@@ -9606,16 +10317,15 @@ static void mg_tls_encrypt(struct mg_connection *c, const uint8_t *msg,
   nonce[10] ^= (uint8_t) ((tls->sseq >> 8) & 255U);
   nonce[11] ^= (uint8_t) ((tls->sseq) & 255U);
 
-  gcm_initialize();
   mg_iobuf_add(wio, wio->len, hdr, sizeof(hdr));
   mg_iobuf_resize(wio, wio->len + encsz);
   outmsg = wio->buf + wio->len;
   tag = wio->buf + wio->len + msgsz + 1;
   memmove(outmsg, msg, msgsz);
   outmsg[msgsz] = msgtype;
-  aes_gcm_encrypt(outmsg, outmsg, msgsz + 1, tls->server_write_key,
-                  sizeof(tls->server_write_key), nonce, sizeof(nonce),
-                  associated_data, sizeof(associated_data), tag, 16);
+  gcm_crypt_and_tag(&tls->server_gcm, ENCRYPT, nonce, sizeof(nonce),
+                    associated_data, sizeof(associated_data), outmsg, outmsg,
+                    msgsz + 1, tag, 16);
   wio->len += encsz;
   tls->sseq++;
 }
@@ -9629,40 +10339,61 @@ static int mg_tls_recv_decrypt(struct mg_connection *c, void *buf,
   uint16_t msgsz;
   uint8_t *msg;
   uint8_t nonce[12];
+  size_t n;
   int r;
-  for (;;) {
-    if (!mg_tls_got_msg(c)) {
-      return MG_IO_WAIT;
+  // A decrypted record larger than the caller buffer is handed out in parts
+  if (tls->recv_len == 0) {
+    for (;;) {
+      if (!mg_tls_got_msg(c)) {
+        return MG_IO_WAIT;
+      }
+      if (rio->buf[0] == 0x17) {
+        break;
+      } else if (rio->buf[0] == 0x15) {
+        MG_INFO(("TLS ALERT packet received"));
+        mg_tls_drop_packet(rio);
+      } else {
+        mg_error(c, "unexpected packet");
+        return -1;
+      }
     }
-    if (rio->buf[0] == 0x17) {
-      break;
-    } else if (rio->buf[0] == 0x15) {
-      MG_INFO(("TLS ALERT packet received"));  // TODO: drop packet?
-    } else {
-      mg_error(c, "unexpected packet");
+    msgsz = MG_LOAD_BE16(rio->buf + 3);
+    msg = rio->buf + TLS_HDR_SIZE;
+    if (msgsz < 16 + 1) {
+      mg_error(c, "TLS record too short");
       return -1;
     }
-  }
-  msgsz = MG_LOAD_BE16(rio->buf + 3);
-  msg = rio->buf + 5;
-  memmove(nonce, tls->client_write_iv, sizeof(tls->client_write_iv));
-  nonce[8] ^= (uint8_t) ((tls->cseq >> 24) & 255U);
-  nonce[9] ^= (uint8_t) ((tls->cseq >> 16) & 255U);
-  nonce[10] ^= (uint8_t) ((tls->cseq >> 8) & 255U);
-  nonce[11] ^= (uint8_t) ((tls->cseq) & 255U);
-  aes_gcm_decrypt(msg, msg, msgsz - 16, tls->client_write_key,
-                  sizeof(tls->client_write_key), nonce, sizeof(nonce));
-  r = msgsz - 16 - 1;
-  if (msg[r] == 0x17) {
-    if (bufsz > 0) {
-      memmove(buf, msg, msgsz - 16);
+    memmove(nonce, tls->client_write_iv, sizeof(tls->client_write_iv));
+    nonce[8] ^= (uint8_t) ((tls->cseq >> 24) & 255U);
+    nonce[9] ^= (uint8_t) ((tls->cseq >> 16) & 255U);
+    nonce[10] ^= (uint8_t) ((tls->cseq >> 8) & 255U);
+    nonce[11] ^= (uint8_t) ((tls->cseq) & 255U);
+    // Record header is the additional data (RFC8446 5.2)
+    if (gcm_auth_decrypt(&tls->client_gcm, nonce, sizeof(nonce), rio->buf,
+                         TLS_HDR_SIZE, msg, msg, msgsz - 16, msg + msgsz - 16,
+                         16) != 0) {
+      mg_error(c, "TLS record auth failed");
+      return -1;
     }
-  } else {
-    r = 0;
+    tls->cseq++;
+    // Strip zero padding, the last non-zero byte is the content type
+    r = msgsz - 16 - 1;
+    while (r > 0 && msg[r] == 0) r--;
+    if (msg[r] != 0x17 || r == 0) {
+      mg_tls_drop_packet(rio);
+      return 0;
+    }
+    tls->recv_offset = 0;
+    tls->recv_len = (size_t) r;
   }
-  tls->cseq++;
-  mg_tls_drop_packet(rio);
-  return r;
+  n = bufsz < tls->recv_len ? bufsz : tls->recv_len;
+  memmove(buf, rio->buf + TLS_HDR_SIZE + tls->recv_offset, n);
+  tls->recv_offset += n;
+  tls->recv_len -= n;
+  if (tls->recv_len == 0) {
+    mg_tls_drop_packet(rio);
+  }
+  return (int) n;
 }
 
 static void mg_tls_server_extensions(struct mg_connection *c) {
@@ -9831,6 +10562,7 @@ static void mg_tls_generate_application_keys(struct mg_connection *c) {
   mg_tls_derive_secret("tls13 derived", tls->handshake_secret, 32,
                        zeros_sha256_digest, 32, premaster_secret, 32);
   mg_hmac_sha256(master_secret, premaster_secret, 32, zeros, 32);
+  memmove(tls->master_secret, master_secret, sizeof(master_secret));
 
   mg_tls_derive_secret("tls13 s ap traffic", master_secret, 32, hash, 32,
                        server_secret, 32);
@@ -9844,10 +10576,58 @@ static void mg_tls_generate_application_keys(struct mg_connection *c) {
                        tls->client_write_key, 16);
   mg_tls_derive_secret("tls13 iv", client_secret, 32, NULL, 0,
                        tls->client_write_iv, 12);
+  mg_tls_expand_keys(tls);
 
   tls->sseq = tls->cseq = 0;
 }
 
+// issue a session ticket, so the client can resume the session later
+static void mg_tls_server_new_ticket(struct mg_connection *c) {
+  struct tls_data *tls = c->tls;
+  struct mg_iobuf *wio = &tls->send;
+  struct mg_tls_tickets *tt = (struct mg_tls_tickets *) c->mgr->tls_ctx;
+  struct mg_tls_ticket *t;
+  mg_sha256_ctx sha256;
+  uint8_t hash[32], res_secret[32];
+  uint8_t finish[36] = {0x14, 0, 0, 32};
+  uint8_t nonce[1] = {0};
+  uint32_t lifetime = MG_TLS_TICKET_LIFETIME;
+  // type, length, lifetime, age_add, nonce, ticket, no extensions
+  uint8_t msg[4 + 4 + 4 + 2 + 2 + 16 + 2] = {0x04, 0, 0, 30};
+  long n;
+
+  if (tt == NULL) return;
+
+  // client Finished isn't in the transcript yet - it's known anyway
+  memmove(&sha256, &tls->sha256, sizeof(mg_sha256_ctx));
+  mg_sha256_final(hash, &sha256);
+  mg_hmac_sha256(finish + 4, tls->client_finished_key, 32, hash, 32);
+  memmove(&sha256, &tls->sha256, sizeof(mg_sha256_ctx));
+  mg_sha256_update(&sha256, finish, sizeof(finish));
+  mg_sha256_final(hash, &sha256);
+
+  mg_tls_derive_secret("tls13 res master", tls->master_secret, 32, hash, 32,
+                       res_secret, 32);
+
+  t = &tt->tickets[tt->next++ % MG_TLS_TICKETS];
+  mg_random(t->id, sizeof(t->id));
+  mg_tls_derive_secret("tls13 resumption", res_secret, 32, nonce,
+                       sizeof(nonce), t->psk, sizeof(t->psk));
+  t->expire = mg_millis() + (uint64_t) lifetime * 1000;
+
+  msg[4] = (uint8_t) (lifetime >> 24), msg[5] = (uint8_t) (lifetime >> 16);
+  msg[6] = (uint8_t) (lifetime >> 8), msg[7] = (uint8_t) lifetime;
+  mg_random(msg + 8, 4);  // ticket_age_add
+  msg[12] = sizeof(nonce), msg[13] = nonce[0];
+  msg[14] = 0, msg[15] = sizeof(t->id);
+  memmove(msg + 16, t->id, sizeof(t->id));
+
+  mg_tls_encrypt(c, msg, sizeof(msg), 0x16);
+  if ((n = mg_io_send(c, wio->buf, wio->len)) > 0) {
+    mg_iobuf_del(wio, 0, (size_t) n);
+  }
+}
+
 void mg_tls_handshake(struct mg_connection *c) {
   struct tls_data *tls = c->tls;
   switch (tls->state) {
@@ -9861,8 +10641,10 @@ void mg_tls_handshake(struct mg_connection *c) {
       mg_tls_server_hello(c);
       mg_tls_generate_handshake_keys(c);
       mg_tls_server_extensions(c);
-      mg_tls_server_cert(c);
-      mg_tls_server_verify_ecdsa(c);
+      if (!tls->resumed) {  // authenticated with PSK otherwise
+        mg_tls_server_cert(c);
+        mg_tls_server_verify_ecdsa(c);
+      }
       mg_tls_server_finish(c);
       tls->state = MG_TLS_HS_CLIENT_CHANGE_CIPHER;
       // fallthrough
@@ -9877,6 +10659,7 @@ void mg_tls_handshake(struct mg_connection *c) {
         return;
       }
       mg_tls_generate_application_keys(c);
+      mg_tls_server_new_ticket(c);
       tls->state = MG_TLS_HS_DONE;
       // fallthrough
     case MG_TLS_HS_DONE: c->is_tls_hs = 0; return;
@@ -9952,8 +10735,12 @@ void mg_tls_init(struct mg_connection *c, const struct mg_tls_opts *opts) {
     return;
   }
 
+  // AES tables are shared by all the connections, fill them once
+  gcm_initialize();
+
   // tls->send.align = tls->recv.align = MG_IO_SIZE;
   tls->send.align = MG_IO_SIZE;
+  tls->ktls_wanted = opts->ktls;
   c->tls = tls;
   c->is_tls = c->is_tls_hs = 1;
   mg_sha256_init(&tls->sha256);
@@ -9964,21 +10751,77 @@ void mg_tls_free(struct mg_connection *c) {
   if (tls != NULL) {
     mg_iobuf_free(&tls->send);
     free((void *) tls->server_cert_der.ptr);
+    gcm_zero_ctx(&tls->server_gcm);
+    gcm_zero_ctx(&tls->client_gcm);
   }
   free(c->tls);
   c->tls = NULL;
 }
 
+#if MG_ENABLE_KTLS
+// Install the server traffic key into the socket. Needs tls->send empty:
+// the kernel continues the record sequence from tls->sseq.
+static void mg_tls_ktls_start(struct mg_connection *c) {
+  struct tls_data *tls = c->tls;
+  struct tls12_crypto_info_aes_gcm_128 ci;
+  uint64_t seq = tls->sseq;
+  int i;
+
+  tls->ktls_wanted = false;  // one attempt, user space encryption otherwise
+  memset(&ci, 0, sizeof(ci));
+  ci.info.version = TLS_1_3_VERSION;
+  ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+  memmove(ci.key, tls->server_write_key, sizeof(ci.key));
+  memmove(ci.salt, tls->server_write_iv, sizeof(ci.salt));
+  memmove(ci.iv, tls->server_write_iv + sizeof(ci.salt), sizeof(ci.iv));
+  for (i = (int) sizeof(ci.rec_seq) - 1; i >= 0; i--, seq >>= 8) {
+    ci.rec_seq[i] = (uint8_t) (seq & 255U);
+  }
+  if (setsockopt(FD(c), IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) != 0 ||
+      setsockopt(FD(c), SOL_TLS, TLS_TX, &ci, sizeof(ci)) != 0) {
+    MG_DEBUG(("%lu kTLS not available, errno %d", c->id, errno));
+  } else {
+    MG_DEBUG(("%lu kTLS TX on", c->id));
+    c->is_ktls = 1;
+  }
+  memset(&ci, 0, sizeof(ci));
+}
+#endif
+
 long mg_tls_send(struct mg_connection *c, const void *buf, size_t len) {
   struct tls_data *tls = c->tls;
+  size_t done = tls->send_plain;
   long n = MG_IO_WAIT;
+
+  // Records built earlier go first. They may hold the head of buf already,
+  // which the caller keeps until we report it sent
+  while (tls->send.len > 0 &&
+         (n = mg_io_send(c, tls->send.buf, tls->send.len)) > 0) {
+    mg_iobuf_del(&tls->send, 0, (size_t) n);
+  }
+  if (n < 0 && n != MG_IO_WAIT) return n;
+  if (tls->send.len > 0) return MG_IO_WAIT;
+  if (done > 0) {
+    tls->send_plain = 0;
+    return (long) done;
+  }
+
+#if MG_ENABLE_KTLS
+  if (tls->ktls_wanted) mg_tls_ktls_start(c);
+  if (c->is_ktls) return mg_io_send(c, buf, len);
+#endif
+
   if (len > MG_IO_SIZE) len = MG_IO_SIZE;
   mg_tls_encrypt(c, buf, len, 0x17);
   while (tls->send.len > 0 &&
          (n = mg_io_send(c, tls->send.buf, tls->send.len)) > 0) {
     mg_iobuf_del(&tls->send, 0, (size_t) n);
   }
-  if (n == MG_IO_ERR || n == MG_IO_WAIT) return n;
+  if (n < 0 && n != MG_IO_WAIT) return n;
+  if (tls->send.len > 0) {
+    tls->send_plain = len;
+    return MG_IO_WAIT;
+  }
   return (long) len;
 }
 
@@ -9987,15 +10830,17 @@ long mg_tls_recv(struct mg_connection *c, void *buf, size_t len) {
 }
 
 size_t mg_tls_pending(struct mg_connection *c) {
-  return mg_tls_got_msg(c) ? 1 : 0;
+  struct tls_data *tls = (struct tls_data *) c->tls;
+  return (tls != NULL && tls->recv_len > 0) || mg_tls_got_msg(c) ? 1 : 0;
 }
 
 void mg_tls_ctx_init(struct mg_mgr *mgr) {
-  (void) mgr;
+  mgr->tls_ctx = calloc(1, sizeof(struct mg_tls_tickets));
 }
 
 void mg_tls_ctx_free(struct mg_mgr *mgr) {
-  (void) mgr;
+  free(mgr->tls_ctx);
+  mgr->tls_ctx = NULL;
 }
 #endif
 
@@ -2162,6 +2162,8 @@ struct mg_mgr {
   void *priv;                   // Used by the MIP stack
   size_t extraconnsize;         // Used by the MIP stack
   MG_SOCKET_TYPE pipe;          // Socketpair end for mg_wakeup()
+  void *iobufs;                 // Recycled IO buffers, see mg_iobuf_recycle()
+  size_t niobufs;               // Number of recycled IO buffers
 #if MG_ENABLE_FREERTOS_TCP
   SocketSet_t ss;  // NOTE(lsm): referenced from socket struct
 #endif
@@ -2202,6 +2204,8 @@ struct mg_connection {
   unsigned is_resp : 1;        // Response is still being generated
   unsigned is_readable : 1;    // Connection is ready to read
   unsigned is_writable : 1;    // Connection is ready to write
+  unsigned is_ktls : 1;        // Kernel encrypts sent TLS records
+  unsigned is_sendfile : 1;    // Kernel sends file content, see static_cb()
 };
 
 void mg_mgr_poll(struct mg_mgr *, int ms);
@@ -2223,6 +2227,8 @@ bool mg_aton(struct mg_str str, struct mg_addr *addr);
 // These functions are used to integrate with custom network stacks
 struct mg_connection *mg_alloc_conn(struct mg_mgr *);
 void mg_close_conn(struct mg_connection *c);
+void mg_iobuf_recycle(struct mg_mgr *, struct mg_iobuf *);  // Frees io
+void mg_iobuf_reuse(struct mg_mgr *, struct mg_iobuf *);    // If io is empty
 bool mg_open_listener(struct mg_connection *c, const char *url);
 
 // Utility functions
@@ -2322,6 +2328,7 @@ struct mg_tls_opts {
   struct mg_str cert;  // PEM or DER
   struct mg_str key;   // PEM or DER
   struct mg_str name;  // If not empty, enable host name verification
+  bool ktls;           // Linux kernel encrypts sent data, builtin TLS only
 };
 
 void mg_tls_init(struct mg_connection *, const struct mg_tls_opts *opts);
@@ -0,0 +1,198 @@
+// Known answer tests for the built-in TLS crypto: SHA-256, AES and AES-GCM
+// (GHASH) against the published vectors, then the hardware kernels against
+// the C code on random input. The C code is checked on every platform, the
+// kernels on x86_64 CPUs that have them.
+//
+//   cc -O2 -I.. crypto-vectors.c -o crypto-vectors && ./crypto-vectors
+
+#include "../mongoose.c"
+
+#include <stdio.h>
+
+static int s_failed;
+
+#define CHECK(what, a, b, n)                                           \
+  do {                                                                 \
+    if (memcmp((a), (b), (n)) != 0) {                                  \
+      printf("FAIL %s, %s (line %d)\n", what, s_mode, __LINE__);       \
+      s_failed++;                                                      \
+    }                                                                  \
+  } while (0)
+
+static const char *s_mode = "C";
+
+static size_t unhex(const char *s, uint8_t *buf) {
+  size_t n = strlen(s) / 2;
+  mg_unhex(s, n * 2, buf);
+  return n;
+}
+
+static void sha256(const void *data, size_t len, size_t repeat,
+                   uint8_t out[32]) {
+  mg_sha256_ctx ctx;
+  mg_sha256_init(&ctx);
+  while (repeat-- > 0) mg_sha256_update(&ctx, (const uint8_t *) data, len);
+  mg_sha256_final(out, &ctx);
+}
+
+// FIPS 180-2 B.1, B.2, B.3
+static void test_sha256(void) {
+  static const char *m2 =
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+  uint8_t want[32], got[32];
+
+  unhex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        want);
+  sha256("abc", 3, 1, got);
+  CHECK("SHA-256 abc", got, want, 32);
+
+  unhex("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+        want);
+  sha256(m2, strlen(m2), 1, got);
+  CHECK("SHA-256 448 bits", got, want, 32);
+
+  unhex("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+        want);
+  sha256("aaaaaaaaaa", 10, 100000, got);
+  CHECK("SHA-256 million a", got, want, 32);
+}
+
+// FIPS-197 C.1, C.2, C.3
+static void test_aes(void) {
+  static const struct {
+    const char *key, *ct;
+  } v[] = {
+      {"000102030405060708090a0b0c0d0e0f", "69c4e0d86a7b0430d8cdb78070b4c55a"},
+      {"000102030405060708090a0b0c0d0e0f1011121314151617",
+       "dda97ca4864cdfe06eaf70a0ec0d7191"},
+      {"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+       "8ea2b7ca516745bfeafc49904b496089"},
+  };
+  uint8_t key[32], pt[16], want[16], got[16];
+  size_t i;
+
+  unhex("00112233445566778899aabbccddeeff", pt);
+  for (i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+    aes_context aes;
+    size_t n = unhex(v[i].key, key);
+    unhex(v[i].ct, want);
+    aes_setkey(&aes, ENCRYPT, key, (uint) n);
+    aes_cipher(&aes, pt, got);
+    CHECK("AES", got, want, 16);
+  }
+}
+
+// McGrew and Viega, "The Galois/Counter Mode of Operation", test cases 2, 4
+static void test_gcm(void) {
+  static const struct {
+    const char *key, *iv, *aad, *pt, *ct, *tag;
+  } v[] = {
+      {"00000000000000000000000000000000", "000000000000000000000000", "",
+       "00000000000000000000000000000000", "0388dace60b6a392f328c2b971b2fe78",
+       "ab6e47d42cec13bdf53a67b21257bddf"},
+      {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+       "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+       "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+       "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+       "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+       "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+       "5bc94fbc3221a5db94fae95ae7121a47"},
+  };
+  uint8_t key[16], iv[12], aad[20], pt[64], ct[64], tag[16], out[64], t[16];
+  size_t i;
+
+  for (i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+    gcm_context gcm;
+    size_t aad_len, len;
+    unhex(v[i].key, key);
+    unhex(v[i].iv, iv);
+    aad_len = unhex(v[i].aad, aad);
+    len = unhex(v[i].pt, pt);
+    unhex(v[i].ct, ct);
+    unhex(v[i].tag, tag);
+
+    gcm_setkey(&gcm, key, sizeof(key));
+    gcm_crypt_and_tag(&gcm, ENCRYPT, iv, sizeof(iv), aad, aad_len, pt, out,
+                      len, t, sizeof(t));
+    CHECK("GCM ciphertext", out, ct, len);
+    CHECK("GCM tag", t, tag, 16);
+    if (gcm_auth_decrypt(&gcm, iv, sizeof(iv), aad, aad_len, ct, out, len, tag,
+                         sizeof(tag)) != 0) {
+      printf("FAIL GCM auth, %s\n", s_mode);
+      s_failed++;
+    }
+    CHECK("GCM plaintext", out, pt, len);
+  }
+}
+
+#if MG_ENABLE_HW_CRYPTO
+static uint8_t rnd(void) {
+  static uint64_t s = 88172645463325252ULL;  // xorshift64
+  s ^= s << 13, s ^= s >> 7, s ^= s << 17;
+  return (uint8_t) s;
+}
+
+static void fill(uint8_t *buf, size_t len) {
+  while (len-- > 0) *buf++ = rnd();
+}
+
+// Every kernel the CPU has against the C code
+static void test_random(unsigned hw) {
+  int i;
+  for (i = 0; i < 1000; i++) {
+    uint8_t key[32], iv[12], aad[40], pt[300], c1[300], c2[300], t1[16],
+        t2[16], h1[32], h2[32];
+    size_t ks = 16 + 8 * (size_t) (i % 3), len = rnd() + rnd() % 45,
+           aad_len = rnd() % 40;
+    aes_context aes;
+    gcm_context gcm;
+    fill(key, sizeof(key)), fill(iv, sizeof(iv)), fill(aad, sizeof(aad));
+    fill(pt, sizeof(pt));
+
+    mg_hw_crypto = 0;
+    aes_setkey(&aes, ENCRYPT, key, (uint) ks);
+    aes_cipher(&aes, pt, c1);
+    mg_hw_crypto = hw;
+    aes_cipher(&aes, pt, c2);
+    CHECK("random AES", c1, c2, 16);
+
+    mg_hw_crypto = 0;
+    gcm_setkey(&gcm, key, 16);
+    gcm_crypt_and_tag(&gcm, ENCRYPT, iv, sizeof(iv), aad, aad_len, pt, c1,
+                      len, t1, sizeof(t1));
+    sha256(pt, len, 1, h1);
+    mg_hw_crypto = hw;
+    gcm_setkey(&gcm, key, 16);
+    gcm_crypt_and_tag(&gcm, ENCRYPT, iv, sizeof(iv), aad, aad_len, pt, c2,
+                      len, t2, sizeof(t2));
+    sha256(pt, len, 1, h2);
+    CHECK("random GCM ciphertext", c1, c2, len);
+    CHECK("random GCM tag", t1, t2, 16);
+    CHECK("random SHA-256", h1, h2, 32);
+  }
+}
+#endif
+
+int main(void) {
+  gcm_initialize();
+#if MG_ENABLE_HW_CRYPTO
+  {
+    unsigned hw = mg_hw_crypto, cpu = mg_cpu_features();
+    printf("CPU kernels 0x%x, enabled 0x%x\n", cpu, hw);
+    if (hw != cpu) {
+      printf("FAIL self-test disabled kernels 0x%x\n", cpu & ~hw);
+      s_failed++;
+    }
+    mg_hw_crypto = 0;
+    test_sha256(), test_aes(), test_gcm();
+    mg_hw_crypto = hw;
+    s_mode = "HW";
+    test_sha256(), test_aes(), test_gcm();
+    test_random(hw);
+  }
+#else
+  test_sha256(), test_aes(), test_gcm();
+#endif
+  printf("%s\n", s_failed ? "FAILED" : "OK");
+  return s_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+// TFlowRing of the smallest configurable size must take a full
+// TFLOW_MG_PART_SIZE part at every offset once it is empty - flushBacklog()
+// retries the same part until it fits.
+//
+//   c++ -O2 -I.. ring-offsets.cpp ../tflow-ring.cpp -o ring-offsets && ./ring-offsets
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../tflow-ring.hpp"
+#include "../tflow-settings.hpp"
+
+static int failed;
+
+static size_t pos;              // Producer's offset in the ring
+static const char *base;        // Ring's buffer
+
+// Pushes len bytes, checks they arrived and pops them again
+static bool check(TFlowRing &ring, const char *data, size_t len)
+{
+    struct iovec iov = { .iov_base = (void*)data, .iov_len = len };
+    const char *rec;
+    size_t rec_len;
+    size_t rec_size = (sizeof(uint64_t) + len + 7) & ~(size_t)7;
+
+    if (!ring.push(&iov, 1, nullptr)) {
+        printf("FAIL push %zu bytes at offset %zu\n", len, pos);
+        return false;
+    }
+    if (!ring.peek(&rec, &rec_len) || rec_len != len || memcmp(rec, data, len) != 0) {
+        printf("FAIL peek %zu bytes at offset %zu\n", len, pos);
+        return false;
+    }
+    if (rec_size > TFLOW_SETTINGS_MIN_RING_SIZE - pos) pos = 0;    // Wrapped
+    if (base == nullptr) base = rec - sizeof(uint64_t);
+    if (rec != base + pos + sizeof(uint64_t)) {
+        printf("FAIL %zu bytes at offset %zu, expected %zu\n", len, 
+            (size_t)(rec - sizeof(uint64_t) - base), pos);
+        return false;
+    }
+    ring.pop();
+    if (ring.peek(&rec, &rec_len)) {
+        printf("FAIL ring is not empty at offset %zu\n", pos);
+        return false;
+    }
+    pos = (pos + rec_size) % TFLOW_SETTINGS_MIN_RING_SIZE;
+    return true;
+}
+
+// Moves the empty ring to ofs with filler records
+static bool seek(TFlowRing &ring, const char *filler, size_t ofs)
+{
+    if (ofs < pos && !check(ring, filler, TFLOW_SETTINGS_MIN_RING_SIZE - pos - sizeof(uint64_t))) {
+        return false;
+    }
+    if (ofs > pos && !check(ring, filler, ofs - pos - sizeof(uint64_t))) {
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    TFlowRing ring(TFLOW_SETTINGS_MIN_RING_SIZE);
+    std::vector<char> msg(TFLOW_MG_PART_SIZE + 64);     // Part and its mg_msg_hdr
+    std::vector<char> filler(TFLOW_SETTINGS_MIN_RING_SIZE);
+
+    for (size_t i = 0; i < msg.size(); i++) msg[i] = (char)(i * 31 + 7);
+
+    // Records, so the offsets, are multiples of 8 bytes
+    for (size_t ofs = 0; ofs < TFLOW_SETTINGS_MIN_RING_SIZE && failed < 10; ofs += 8) {
+        if (!seek(ring, filler.data(), ofs) || !check(ring, msg.data(), msg.size())) failed++;
+    }
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
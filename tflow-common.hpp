@@ -1,6 +1,12 @@
 #pragma once
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+// Identifies an HTTP request on its way Mongoose -> TFlow module -> Mongoose
+struct TFlowReqId {
+    unsigned long conn_id = 0;  // Mongoose connection. 0 - internal request
+    int seq = 0;                // Request number assigned by Mongoose
+};
+
 class Flag {
 public:
     enum states {
@@ -8,25 +8,54 @@
 
 #include "tflow-control.hpp"
 
-#define  IDLE_INTERVAL_MSEC 100
-
-TFlowControl::TFlowControl()
+#define ROUTE(_ui_name, _srv, _cmd_prefix, _flags) \
+    { _ui_name, sizeof(_ui_name) - 1, TFlowControl::_srv, _cmd_prefix, sizeof(_cmd_prefix) - 1, _flags }
+
+const char* const TFlowControl::srv_names[] = {
+#define X(_id, _name) _name,
+    TFLOW_SERVERS(X)
+#undef X
+};
+
+// Adding a UI module is a matter of this table. TFlow modules are listed
+// in TFLOW_SERVERS. For UI modules served by the same TFlow module the more specific ones
+// (CMD_IS_NAME, cmd_prefix) go first.
+const TFlowControl::route TFlowControl::routes[] = {
+    ROUTE("capture",    SRV_NAME_CAPTURE, "",           route::CFG_ID),
+    ROUTE("player",     SRV_NAME_PROCESS, "",           route::CMD_IS_NAME),
+    ROUTE("player_dir", SRV_NAME_PROCESS, "",           route::CMD_IS_NAME),
+    ROUTE("joystick",   SRV_NAME_PROCESS, "",           route::CMD_IS_NAME | route::EVENTS),   // Binary frames on /websocket
+    ROUTE("mvision",    SRV_NAME_PROCESS, "",           route::CFG_ID | route::CONTROLS),
+    ROUTE("recording",  SRV_NAME_VSTREAM, "recording_", route::CFG_ID),
+    ROUTE("streaming",  SRV_NAME_VSTREAM, "streaming_", route::CFG_ID),
+    { nullptr }
+};
+
+TFlowControl::TFlowControl(const char *settings_path)
 {
+    cfg.load(settings_path);
+
     context = g_main_context_new();
     g_main_context_push_thread_default(context);
     
     main_loop = g_main_loop_new(context, false);
 
-    // TFlowControl::SRV_NAME
-    tflow_ctrl_clis.reserve(3);
-    tflow_ctrl_clis.emplace_back(this, (const char*)"Capture"); 
-    tflow_ctrl_clis.emplace_back(this, (const char*)"Process");
-    tflow_ctrl_clis.emplace_back(this, (const char*)"VStream");
+    // Indexed by TFlowControl::SRV_NAME
+    tflow_ctrl_clis.reserve(NUM);
+    for (int srv = 0; srv < NUM; srv++) {
+        tflow_ctrl_clis.emplace_back(this, srv, srv_names[srv]);
+    }
 #if CODE_BROWSE
     TFlowCtrlCli;
 #endif 
 
     tflow_mg = new TFlowMg(this);
+
+    // Nothing polls the modules - each client connects from the main loop 
+    // and keeps reconnecting on its own timer
+    for (auto& cli : tflow_ctrl_clis) {
+        cli.Start();
+    }
 }
 
 TFlowControl::~TFlowControl()
@@ -42,38 +71,7 @@ TFlowControl::~TFlowControl()
 }
 
 
-static gboolean tflow_control_idle(gpointer data)
-{
-    TFlowControl* app = (TFlowControl*)data;
-    app->OnIdle();
-
-    return true;
-}
-
-void TFlowControl::OnIdle()
-{
-    struct timespec now_tp;
-    clock_gettime(CLOCK_MONOTONIC, &now_tp);
-
-    // TODO: Chek inet connection 
-    //       If OK start MG server
-    for (auto& cli : tflow_ctrl_clis) {
-        cli.onIdle(&now_tp);
-    }
-
-}
-
-void TFlowControl::AttachIdle()
-{
-    GSource* src_idle = g_timeout_source_new(IDLE_INTERVAL_MSEC);
-    g_source_set_callback(src_idle, (GSourceFunc)tflow_control_idle, this, nullptr);
-    g_source_attach(src_idle, context);
-    g_source_unref(src_idle);
-
-    return;
-}
-
-void TFlowControl::saveCfgID(const char* module_name, int new_id)
+bool TFlowControl::saveCfgID(const char* module_name, int new_id)
 {
     // Add config ID to parent's map
     if (new_id >= 0) {
@@ -90,10 +88,39 @@ void TFlowControl::saveCfgID(const char* module_name, int new_id)
             new_id = -1;
         }
         config_ids.insert_or_assign(module_name, new_id);
+        return new_id != last_known_id;
     }
 
+    return false;
+}
+
+// Web UI request's top level key -> route
+const TFlowControl::route* TFlowControl::findRoute(const char *ui_name, size_t len)
+{
+    for (const route *r = routes; r->ui_name; r++) {
+        if (r->ui_name_len == len && 0 == memcmp(r->ui_name, ui_name, len)) {
+            return r;
+        }
+    }
+    return nullptr;
 }
 
+// TFlow module's response command -> route
+const TFlowControl::route* TFlowControl::findRespRoute(int srv, const char *cmd, size_t len)
+{
+    for (const route *r = routes; r->ui_name; r++) {
+        if (r->srv != srv) continue;
+
+        if (r->flags & route::CMD_IS_NAME) {
+            if (r->ui_name_len == len && 0 == memcmp(r->ui_name, cmd, len)) return r;
+            continue;
+        }
+        if (r->cmd_prefix_len > len || 0 != memcmp(r->cmd_prefix, cmd, r->cmd_prefix_len)) continue;
+
+        return r;
+    }
+    return nullptr;
+}
 
 #if 0
 void TFlowControl::onCliRespMsg(TFlowCtrlCli *cli, const char* resp_name, 
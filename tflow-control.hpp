@@ -6,31 +6,63 @@
 #include <giomm.h>
 
 #include "tflow-common.hpp"
+#include "tflow-metrics.hpp"
+#include "tflow-settings.hpp"
 #include "tflow-ctrl-cli.hpp"
 #include "tflow-mg.hpp"
 
 class TFlowControl {
 public:
+    // TFlow modules, a TFlowCtrlCli each. Adding a TFlow module is a line
+    // here, its UI modules go to routes[].
+#define TFLOW_SERVERS(X)        \
+        X(CAPTURE, "Capture")   \
+        X(PROCESS, "Process")   \
+        X(VSTREAM, "VStream")
+
     enum SRV_NAME {
-        SRV_NAME_CAPTURE = 0,
-        SRV_NAME_PROCESS = 1,
-        SRV_NAME_VSTREAM = 2,
-        NUM     = 3
+#define X(_id, _name) SRV_NAME_##_id,
+        TFLOW_SERVERS(X)
+#undef X
+        NUM
     };
+    static const char* const srv_names[NUM];
+
+    // Web UI <-> TFlow module routing. Top level keys of Web UI messages are
+    // "UI modules"; several UI modules may be served by one TFlow module.
+    struct route {
+        static constexpr int CMD_IS_NAME = 1;   // UI module is the command itself - {"player" : { params } }
+        static constexpr int CFG_ID      = 2;   // Tracks module's config_id
+        static constexpr int CONTROLS    = 4;   // Empty request asks for "controls"
+        static constexpr int EVENTS      = 8;   // Fire-and-forget events only, no /api requests
+
+        const char *ui_name;
+        size_t      ui_name_len;
+        SRV_NAME    srv;
+        const char *cmd_prefix;                 // Distinguishes UI modules sharing commands
+        size_t      cmd_prefix_len;
+        int         flags;
+    };
+
+    static const route routes[];
+    static const route* findRoute(const char *ui_name, size_t len);
+    static const route* findRespRoute(int srv, const char *cmd, size_t len);
 
-    TFlowControl();
+    TFlowControl(const char *settings_path);
     ~TFlowControl();
 
+    TFlowSettings cfg;          // Read-only after the constructor
+
     GMainContext *context;
     GMainLoop *main_loop;
-    
-    void AttachIdle();
-    void OnIdle();
+
 
     std::vector<TFlowCtrlCli> tflow_ctrl_clis; 
     TFlowMg *tflow_mg;
 
-    void saveCfgID(const char* module_name, int new_id);
+    TFlowMetrics metrics;       // Shared with Mongoose thread
+
+    bool saveCfgID(const char* module_name, int new_id);
     std::unordered_map<std::string, int> config_ids;
 private:
 
@@ -12,6 +12,16 @@
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+#define TFLOWCTRLCLI_MAX_PENDING 64
+
+#define TFLOWCTRLCLI_MAX_MSG_SIZE (64 * 1024 * 1024)
+
+#define TFLOWCTRLCLI_SCK_EVENTS    (GIOCondition)(G_IO_IN | G_IO_ERR | G_IO_HUP)
+
+// Module's responses carrying config_id
+static const char *cfg_id_cmds[] = {
+    "signature", "config", "config_streamer", "config_recorder", "ui_sign", nullptr };
+
 static struct timespec diff_timespec(
     const struct timespec* time1,
     const struct timespec* time0)
@@ -35,27 +45,34 @@ static double diff_timespec_msec(
     return d_tp.tv_sec * 1000 + (double)d_tp.tv_nsec / (1000 * 1000);
 }
 
-TFlowCtrlCli::TFlowCtrlCli(TFlowControl* _app, const char *_srv_name) 
+TFlowCtrlCli::TFlowCtrlCli(TFlowControl* _app, int _srv_id, const char *_srv_name) 
 {
     app = _app;
 
+    srv_id = _srv_id;
     srv_name = std::string(_srv_name);
 
-    sck_state_flag.v = Flag::UNDEF;
+    sck_fd = -1;
     sck_tag = NULL;
     sck_src = NULL;
     CLEAR(sck_gsfuncs);
 
-    in_msg_size = 1024 * 1024;
-    in_msg = (char*)g_malloc(in_msg_size);
+    dispatch_budget = app->cfg.cli_dispatch_budget;
 
-    last_idle_check_tp = { 0 };
+    in_msg_size = app->cfg.cli_in_msg_size;      // Grows on demand
+    in_msg = (char*)g_malloc(in_msg_size);
 }
 
 TFlowCtrlCli::~TFlowCtrlCli()
 {
     Disconnect();
 
+    if (reconnect_src) {
+        g_source_destroy(reconnect_src);
+        g_source_unref(reconnect_src);
+        reconnect_src = nullptr;
+    }
+
     if (in_msg) {
         g_free(in_msg);
     }
@@ -69,17 +86,81 @@ int TFlowCrlCli::onXXX()
 }
 #endif
 
-int TFlowCtrlCli::onCtrlMsgParse(const char *ctrl_in_msg)
+// Module's payload ("params") is forwarded to the Web UI as is - only the 
+// top level fields are scanned and the envelope is spliced around the raw 
+// bytes. No DOM is built for the message.
+int TFlowCtrlCli::onCtrlMsgParse(const char *ctrl_in_msg, size_t len)
 {
-    std::string j_err;
-    const json11::Json j_in_msg = json11::Json::parse(ctrl_in_msg, j_err);
+    struct mg_str j_in_msg = mg_str_n(ctrl_in_msg, len);
+    struct mg_str key, val;
+    struct mg_str ctrl_resp_cmd = {}, ctrl_resp_seq = {}, ctrl_resp_err = {},
+        ctrl_resp_err_msg = {}, ctrl_resp_params = {};
+    size_t ofs = 0;
+
+    if (len == 0 || *ctrl_in_msg != '{') {
+        g_warning("TFlowCtrlCli: bad ctrl response - not an object");
+        return 0;
+    }
+
+    while ((ofs = mg_json_next(j_in_msg, ofs, &key, &val)) > 0) {
+        if      (0 == mg_vcmp(&key, "\"cmd\""))     ctrl_resp_cmd = val;
+        else if (0 == mg_vcmp(&key, "\"seq\""))     ctrl_resp_seq = val;
+        else if (0 == mg_vcmp(&key, "\"err\""))     ctrl_resp_err = val;
+        else if (0 == mg_vcmp(&key, "\"err_msg\"")) ctrl_resp_err_msg = val;
+        else if (0 == mg_vcmp(&key, "\"params\""))  ctrl_resp_params = val;
+    }
+
+    // Command name is a quoted string. Keep the quotes for the envelope.
+    bool cmd_is_string = ctrl_resp_cmd.len >= 2 && ctrl_resp_cmd.ptr[0] == '"';
+    std::string cmd_name = cmd_is_string ?
+        std::string(ctrl_resp_cmd.ptr + 1, ctrl_resp_cmd.len - 2) : std::string();
 
-    if (j_in_msg.is_null()) {
-        g_warning("TFlowCtrlCli: bad ctrl response - %s", j_err.c_str());
+    // Find out the originator of the request. Unsolicited messages from
+    // the module have no one waiting.
+    double seq_num = 0;
+    bool has_seq = mg_json_get_num(ctrl_resp_seq, "$", &seq_num);
+
+    // Heartbeat is TFlowControl's own business
+    if (cmd_is_string && has_seq && cmd_name == "ping") {
+        onPong((int)seq_num);
         return 0;
     }
 
-    const json11::Json ctrl_resp_cmd = j_in_msg["cmd"];
+    // Events have no response. A reply the module sends anyway, an error of
+    // a module that doesn't know the event, must not take a request's place.
+    const TFlowControl::route *route = cmd_is_string ?
+        TFlowControl::findRespRoute(srv_id, cmd_name.c_str(), cmd_name.length()) : nullptr;
+    if (route && (route->flags & TFlowControl::route::EVENTS)) {
+        PRESC(0x3F) {
+            g_warning("TFlowCtrlCli: [%s] replied to event %s - ignored",
+                srv_name.c_str(), cmd_name.c_str());
+        }
+        return 0;
+    }
+
+    TFlowReqId mg_req;
+    pending_req req;
+    bool is_resp = has_seq;
+    if (cmd_is_string && takePendingReq(has_seq, (int)seq_num, req)) {
+        struct timespec now_tp;
+        clock_gettime(CLOCK_MONOTONIC, &now_tp);
+        double rtt_msec = diff_timespec_msec(&now_tp, &req.send_tp);
+
+        g_info("TFlowCtrlCli: [%s] <<- [%s]  %s #%d (%.1f ms)", 
+            my_cli_name.c_str(), srv_name.c_str(),
+            cmd_name.c_str(), req.seq, rtt_msec);
+
+        TFlowHist *hist = app->metrics.moduleHist(srv_name.c_str(), cmd_name.c_str());
+        if (hist) hist->add((uint64_t)(rtt_msec * 1000));
+
+        mg_req = req.mg_req;
+        is_resp = true;
+    }
+
+    // Only unsolicited messages go to all WebSocket clients. Responses to
+    // TFlowControl's own requests ("signature") and late ones to forgotten
+    // requests end here.
+    bool to_mg = !is_resp || mg_req.conn_id != 0;
 
     //{ "cmd"     , cmd           },
     //{ "dir"     , "response"    },        // For better log readability only
@@ -87,145 +168,169 @@ int TFlowCtrlCli::onCtrlMsgParse(const char *ctrl_in_msg)
     //{ "err_msg" , resp_err_str  },        // Present in case of error
     //{ "params"  , j_resp_params }         // Present in case of NO error
 
-    if (!ctrl_resp_cmd.is_string()) {
+    if (!cmd_is_string) {
         //app->tflow_mg->sendMsgToMg(...);
         return 0;
     }
 
-    const json11::Json &ctrl_resp_err = j_in_msg["err"];
-    const json11::Json &ctrl_resp_err_msg = j_in_msg["err_msg"];
+    double err_num;
+    if (mg_json_get_num(ctrl_resp_err, "$", &err_num)) {
+        if (!to_mg) {
+            g_warning("TFlowCtrlCli: [%s] %s error %d %.*s", srv_name.c_str(),
+                cmd_name.c_str(), (int)err_num, (int)ctrl_resp_err_msg.len, ctrl_resp_err_msg.ptr);
+            return 0;
+        }
 
-    if (ctrl_resp_err.is_number()) {
         // TFlowCtrlServer Report an error 
         // { "cmd" : { "err" : <code> , "err_msg", "some error text" } }
+        bool err_msg_is_string = ctrl_resp_err_msg.len >= 2 && ctrl_resp_err_msg.ptr[0] == '"';
+
+        std::string j_resp;
+        j_resp.append("{").append(ctrl_resp_cmd.ptr, ctrl_resp_cmd.len)
+            .append(":{\"err\":").append(std::to_string((int)err_num))
+            .append(",\"err_msg\":");
+        if (err_msg_is_string) {
+            j_resp.append(ctrl_resp_err_msg.ptr, ctrl_resp_err_msg.len);
+        }
+        else {
+            j_resp.append("\"unknown\"");
+        }
+        j_resp.append("}}");
 
-        app->tflow_mg->sendMsgToMg(json11::Json::object({ 
-                {
-                    ctrl_resp_cmd.string_value().c_str(),
-                    json11::Json::object({
-                        { "err", ctrl_resp_err.int_value() },
-                        { "err_msg", ctrl_resp_err_msg.is_string() ?
-                            ctrl_resp_err_msg.string_value() : "unknown" } })
-                } })
-        );
+        struct iovec part = { .iov_base = (void*)j_resp.c_str(), .iov_len = j_resp.length() };
+        app->tflow_mg->sendMsgToMg(&part, 1, mg_req);
         return 0;
     }
 
     // All good - repack as { "module"  : { "cmd" : { params } } }
-    const json11::Json &ctrl_resp_params = j_in_msg["params"];
-    if (!ctrl_resp_params.is_object()) {
+    if (ctrl_resp_params.len == 0 || ctrl_resp_params.ptr[0] != '{') {
         return 0;   // Bad format from TFlow Module - do nothing.
     }
 
-    const std::string &cmd_name = ctrl_resp_cmd.string_value();
-    int received_config_id = -1;
-
-    // TODO: Q: ? Direct action via reference or via parent's callback?
-    // Steal config_id from "config" and "ui_sign" commands
-    if (0 == strcmp(cmd_name.c_str(), "signature")       ||
-        0 == strcmp(cmd_name.c_str(), "config")          ||
-        0 == strcmp(cmd_name.c_str(), "config_streamer") ||
-        0 == strcmp(cmd_name.c_str(), "config_recorder") ||
-        0 == strcmp(cmd_name.c_str(), "ui_sign")) {
-            
-        const json11::Json &j_config_id = ctrl_resp_params["config_id"];
-        if (j_config_id.is_number()) {
-            received_config_id = j_config_id.int_value();
-        }
+    // For messages from TFlow modules repack as in the following:
+    // From TFlowCapture : {"cmd" : "config" , "dir": "request", "params" : { _params_ }} }						
+    // TO WEB UI  : {"capture" : { "config" : { _params_ } } }						
+    // From TFlowVStream : {"cmd" : "streaming_config" , "dir": "request", "params" : { _params_ }} }						
+    // TO WEB UI  : {"streaming" : { "config" : { _params_ } } }						
+    // Player mimics a standalone module, but not part of Process
+    // From TFlowProcess : {"cmd" : "player" , "dir": "request", "params" : { _params_ }} }						
+    // TO WEB UI  : {"player" : { _params_ } }
+    if (route == nullptr) {
+        return 0;
     }
 
-#if 0
-    // Call parent's callback
-    ctrl_onRespMsg(this, cmd_name.c_str(), ctrl_resp_params);
-#if CODE_BROWSER
-    TFlowControl::onCliRespMsg(resp, ctrl_resp_params);
-#endif
-#endif
-    if (0 == strcmp(srv_name.c_str(), "Capture")) {
-
-        // For messages from Capture and Process repack as in the following:
-        // From TFlowCapture : {"cmd" : "config" , "dir": "request", "params" : { _params_ }} }						
-        // TO WEB UI  : {"capture" : { "config" : { _params_ } } }						
-        const json11::Json::object j_resp_cmd({
-            { cmd_name, ctrl_resp_params } });      // For ex.: { "config" : { _params_ }
-
-        const json11::Json::object j_resp({                            // For ex.: {"capture" : { "config" : { _params_ } } } 
-            { "capture", j_resp_cmd } });
-
-        app->saveCfgID("capture", received_config_id);  
-
-        app->tflow_mg->sendMsgToMg(j_resp);
-    } 
-    else if (0 == strcmp(srv_name.c_str(), "Process")) {
-
-        if ( 0 == strcmp("player", cmd_name.c_str()) || 
-             0 == strcmp("player_dir", cmd_name.c_str()) ) {
-
-            // Mimic player as a standalone module, but not part of Process
-            const json11::Json::object j_resp({ 
-                { cmd_name.c_str(), ctrl_resp_params } }); 
-
-            app->tflow_mg->sendMsgToMg(j_resp);    // For ex.: {"player" : { _params_ } }  
+    bool cfg_changed = false;
+    if (route->flags & TFlowControl::route::CFG_ID) {
+        // TODO: Q: ? Direct action via reference or via parent's callback?
+        // Steal config_id from "config" and "ui_sign" commands
+        for (const char **c = cfg_id_cmds; *c; c++) {
+            if (0 == strcmp(cmd_name.c_str(), *c)) {
+                double config_id;
+                if (mg_json_get_num(ctrl_resp_params, "$.config_id", &config_id)) {
+                    cfg_changed = app->saveCfgID(route->ui_name, (int)config_id);
+                }
+                break;
+            }
         }
-        else {
-            const json11::Json::object j_resp_cmd({
-                { ctrl_resp_cmd.string_value(), ctrl_resp_params } });      // For ex.: { "config" : { _params_ }
-
-            const json11::Json::object j_resp({ 
-                { "mvision", j_resp_cmd } });                         // For ex.: {"mvision" : { "config" : { _params_ } } } 
-
-            app->saveCfgID("mvision", received_config_id);  
-
-            app->tflow_mg->sendMsgToMg(j_resp);
-        }
-    } 
-    else if (0 == strcmp(srv_name.c_str(), "VStream")) {
-
-        // From TFlowVStream : {"cmd" : "streaming_config" , "dir": "request", "params" : { _params_ }} }						
-        // TO WEB UI  : {"streaming" : { "config" : { _params_ } } }						
-
-        if (0 == strncmp("recording_", cmd_name.c_str(), 10)) {
-            std::string cmd_name_stripped(cmd_name.c_str() + 10);
+    }
 
-            const json11::Json::object j_resp_cmd({
-                { cmd_name_stripped.c_str(), ctrl_resp_params } });      // For ex.: { "config" : { _params_ }
+    if (!to_mg) {
+        return 0;
+    }
 
-            const json11::Json::object j_resp({
-                { "recording", j_resp_cmd } });                          // For ex.: {"recording" : { "config" : { _params_ } } } 
+    std::string resp_prefix;
+    if (route->flags & TFlowControl::route::CMD_IS_NAME) {
+        resp_prefix.append("{").append(ctrl_resp_cmd.ptr, ctrl_resp_cmd.len).append(":");
+        sendRespToMg(resp_prefix, ctrl_resp_params, "}", mg_req, cfg_changed);
+    }
+    else {
+        resp_prefix.append("{\"").append(route->ui_name).append("\":{\"")
+            .append(cmd_name.c_str() + route->cmd_prefix_len).append("\":");
+        sendRespToMg(resp_prefix, ctrl_resp_params, "}}", mg_req, cfg_changed);
+    }
 
-            app->saveCfgID("recording", received_config_id);  
+    //app->tflow_mg->sendMsgToMg(json11::Json::object({ {
+    //    ctrl_resp_cmd.string_value().c_str(),
+    //        ctrl_resp_player_params } } ));
 
-            app->tflow_mg->sendMsgToMg(j_resp);
-        }
-        else if (0 == strncmp("streaming_", cmd_name.c_str(), 10)) {
-            std::string cmd_name_stripped(cmd_name.c_str() + 10);
+    return 0;
+}
 
-            const json11::Json::object j_resp_cmd({
-                { cmd_name_stripped.c_str(), ctrl_resp_params } });      // For ex.: { "config" : { _params_ }
+void TFlowCtrlCli::sendRespToMg(const std::string &prefix, struct mg_str params,
+    const char *suffix, const TFlowReqId &mg_req, bool cfg_changed)
+{
+    struct iovec parts[3] = {
+        { .iov_base = (void*)prefix.c_str(), .iov_len = prefix.length() },
+        { .iov_base = (void*)params.ptr,     .iov_len = params.len },
+        { .iov_base = (void*)suffix,         .iov_len = strlen(suffix) } };
 
-            const json11::Json::object j_resp({
-                { "streaming", j_resp_cmd } });                          // For ex.: {"streaming" : { "config" : { _params_ } } } 
+    // Unsolicited messages (conn_id == 0) are pushed to all WebSocket clients
+    app->tflow_mg->sendMsgToMg(parts, 3, mg_req);
 
-            app->saveCfgID("streaming", received_config_id);  
+    // Let other UI instances know about the configuration change
+    if (cfg_changed && mg_req.conn_id != 0) {
+        app->tflow_mg->sendMsgToMg(parts, 3, TFlowReqId());
+    }
+}
 
-            app->tflow_mg->sendMsgToMg(j_resp);
+bool TFlowCtrlCli::takePendingReq(bool has_seq, int seq, pending_req &req)
+{
+    if (has_seq) {
+        // Module echoes request's "seq" - find the exact request
+        seq_echo = true;
+        for (auto it = pending_reqs.begin(); it != pending_reqs.end(); it++) {
+            if (it->seq == seq) {
+                req = *it;
+                pending_reqs.erase(it);
+                return true;
+            }
         }
+        return false;
+    }
 
+    if (seq_echo || pending_reqs.empty()) {
+        // Not a response
+        return false;
     }
-    //app->tflow_mg->sendMsgToMg(json11::Json::object({ {
-    //    ctrl_resp_cmd.string_value().c_str(),
-    //        ctrl_resp_player_params } } ));
 
-    return 0;
+    // Legacy module without "seq" support responds in order of requests
+    req = pending_reqs.front();
+    pending_reqs.pop_front();
+    return true;
 }
 
+// Returns 1 if a message is processed, 0 if there is nothing to receive
 int TFlowCtrlCli::onCtrlMsg()
 {
     ssize_t res;
     int err;
 
+    // SEQPACKET message is truncated if the buffer is too small. Once a
+    // module has sent such a message, peek the real length first and grow
+    // the buffer if needed. Otherwise it is one recv() per message.
+    if (in_msg_peek) {
+        res = recv(sck_fd, in_msg, 0, MSG_PEEK | MSG_TRUNC | MSG_NOSIGNAL);
+        if (res == -1 && errno == EAGAIN) {
+            return 0;   // All messages are received
+        }
+        if (res > 0 && (size_t)res >= in_msg_size && res < TFLOWCTRLCLI_MAX_MSG_SIZE) {
+            growInMsg(res);
+        }
+    }
+
     // Read-out all data from the socket 
-    res = recv(sck_fd, in_msg, in_msg_size - 1, MSG_NOSIGNAL);
+    res = recv(sck_fd, in_msg, in_msg_size - 1, MSG_TRUNC | MSG_NOSIGNAL);
+    if (res == -1 && errno == EAGAIN) {
+        return 0;   // All messages are received
+    }
+    if (res > 0 && (size_t)res >= in_msg_size) {
+        // The tail is lost already
+        g_warning("TFlowCtrlCli: [%s] message truncated (%ld bytes) - dropped",
+            srv_name.c_str(), res);
+        if (res < TFLOWCTRLCLI_MAX_MSG_SIZE) growInMsg(res);
+        in_msg_peek = true;
+        return 1;
+    }
 
     if (res <= 0) {
         err = errno;
@@ -238,14 +343,96 @@ int TFlowCtrlCli::onCtrlMsg()
                 res, err, strerror(err));
         }
 
-        sck_state_flag.v = Flag::FALL;
-        //last_idle_check = 0; // aka Idle loop kick
         return -1;
     }
 
     in_msg[res] = 0;
 
-    return onCtrlMsgParse(in_msg);
+    // The module is alive - reconnect at once should it go away
+    reconnect_backoff_msec = 0;
+
+    if ((size_t)res >= sizeof(struct tflow_ctrl_chunk_hdr) &&
+        0 == memcmp(in_msg, TFLOWCTRL_CHUNK_MAGIC, 4)) {
+        onCtrlMsgChunk(in_msg, res);
+        return 1;
+    }
+
+    onCtrlMsgParse(in_msg, res);
+
+    // Don't hold memory after a rare big message
+    if (in_msg_size > app->cfg.cli_in_msg_size) {
+        in_msg_size = app->cfg.cli_in_msg_size;
+        in_msg = (char*)g_realloc(in_msg, in_msg_size);
+    }
+
+    return 1;
+}
+
+void TFlowCtrlCli::growInMsg(size_t len)
+{
+    in_msg_size = (len + app->cfg.cli_in_msg_size) & ~(app->cfg.cli_in_msg_size - 1);
+    in_msg = (char*)g_realloc(in_msg, in_msg_size);
+}
+
+int TFlowCtrlCli::onCtrlMsgs()
+{
+    // Drain the socket, but leave the rest for the next main loop iteration
+    // once the budget is exhausted, so other sources are not starved.
+    for (int i = 0; i < dispatch_budget; i++) {
+        int rc = onCtrlMsg();
+        if (rc < 0) return -1;
+        if (rc == 0) break;
+    }
+    return 0;
+}
+
+int TFlowCtrlCli::onCtrlMsgChunk(const char *msg, size_t len)
+{
+    struct tflow_ctrl_chunk_hdr hdr;
+    memcpy(&hdr, msg, sizeof(hdr));
+
+    const char *chunk = msg + sizeof(hdr);
+    size_t chunk_len = len - sizeof(hdr);
+
+    if (hdr.offset == 0) {
+        if (!chunked_msg.empty()) {
+            g_warning("TFlowCtrlCli: [%s] incomplete chunked message dropped (%ld bytes)",
+                srv_name.c_str(), chunked_msg.length());
+        }
+        if (hdr.total > TFLOWCTRLCLI_MAX_MSG_SIZE) {
+            g_warning("TFlowCtrlCli: [%s] chunked message is too big (%u)",
+                srv_name.c_str(), hdr.total);
+            chunked_msg.clear();
+            return 0;
+        }
+        chunked_msg.clear();
+        chunked_msg.reserve(hdr.total);
+    }
+    else if (hdr.offset != chunked_msg.length()) {
+        // Lost the beginning or a chunk in the middle - skip till next message
+        if (!chunked_msg.empty()) {
+            g_warning("TFlowCtrlCli: [%s] chunk out of order (%u, expected %ld)",
+                srv_name.c_str(), hdr.offset, chunked_msg.length());
+        }
+        chunked_msg.clear();
+        return 0;
+    }
+
+    if (chunked_msg.length() + chunk_len > hdr.total) {
+        g_warning("TFlowCtrlCli: [%s] chunk overflows the message", srv_name.c_str());
+        chunked_msg.clear();
+        return 0;
+    }
+
+    chunked_msg.append(chunk, chunk_len);
+    if (chunked_msg.length() < hdr.total) {
+        return 0;   // More chunks to come
+    }
+
+    int rc = onCtrlMsgParse(chunked_msg.c_str(), chunked_msg.length());
+
+    std::string().swap(chunked_msg);    // Release the memory
+    return rc;
 }
 
 gboolean tflow_ctrl_cli_dispatch(GSource* g_source, GSourceFunc callback, gpointer user_data)
@@ -256,10 +443,27 @@ gboolean tflow_ctrl_cli_dispatch(GSource* g_source, GSourceFunc callback, gpoint
 
     g_info("TFlowCtrlCli: Incoming message");
 
-    rc = cli->onCtrlMsg();
+    GIOCondition cond = g_source_query_unix_fd(g_source, cli->sck_tag);
+    if (cond & (G_IO_HUP | G_IO_ERR)) {
+        // The module is gone. Take whatever it managed to send before.
+        while (cli->onCtrlMsg() > 0);
+        cli->onConnLost();
+        return G_SOURCE_REMOVE;
+    }
+
+    if (cond & G_IO_OUT) {
+        cli->flushOutQueue();
+        if (!cli->isConnected()) return G_SOURCE_REMOVE;
+    }
+    if (!(cond & G_IO_IN)) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    rc = cli->onCtrlMsgs();
 
     if (rc) {
         // Critical error on PIPE. 
+        cli->onConnLost();
         return G_SOURCE_REMOVE;
     }
     else {
@@ -268,45 +472,189 @@ gboolean tflow_ctrl_cli_dispatch(GSource* g_source, GSourceFunc callback, gpoint
    
 }
 
-int TFlowCtrlCli::sendMsgToCtrl(const char *cmd, const json11::Json::object &j_params)
+// Returns 1 if sent, 0 if the socket is full, -errno on error
+int TFlowCtrlCli::sendRaw(const std::string &msg)
 {
-    ssize_t res;
+    ssize_t res = send(sck_fd, msg.c_str(), msg.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (res != -1) return 1;
+
+    int err = errno;
+    if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) return 0;
+    return -err;
+}
+
+// Answer the Web UI the way a module reports an error
+void TFlowCtrlCli::rejectReq(const TFlowReqId &mg_req, const char *cmd, int err, const char *err_msg)
+{
+    if (mg_req.conn_id == 0) return;
+
+    app->tflow_mg->sendMsgToMg(json11::Json::object({
+        { cmd, json11::Json::object({ { "err", err }, { "err_msg", err_msg } }) } }), mg_req);
+}
+
+// Settings sent repeatedly, like a slider being dragged, are coalesced - 
+// only the latest value of the same keys matters.
+bool TFlowCtrlCli::isCoalescedCmd(const char *cmd)
+{
+    size_t len = strlen(cmd);
+    return 0 == strcmp(cmd, "ping") ||
+        0 == strncmp(cmd, "config", 6) ||
+        (len > 7 && 0 == strcmp(cmd + len - 7, "_config"));
+}
+
+// A message replaces the queue tail if it has the same non-empty key. An
+// older one further back stays - messages queued after it may touch the
+// same parameters or depend on its value.
+bool TFlowCtrlCli::queueMsg(const char *cmd, std::string &key, std::string &msg,
+    int seq, const TFlowReqId &mg_req)
+{
+    if (!key.empty() && !out_q.empty() && out_q.back().key == key) {
+        out_msg &q = out_q.back();
+
+        // The older request is never sent - let its originator know
+        for (auto it = pending_reqs.begin(); it != pending_reqs.end(); it++) {
+            if (it->seq != q.seq) continue;
+            rejectReq(it->mg_req, cmd, ECANCELED, "superseded");
+            pending_reqs.erase(it);
+            break;
+        }
+        out_q_bytes = out_q_bytes - q.msg.length() + msg.length();
+        q.msg.swap(msg);
+        q.seq = seq;
+        out_coalesced++;
+        return true;
+    }
+
+    if (out_q_bytes + msg.length() > app->cfg.cli_out_queue_bytes) {
+        out_dropped++;
+        PRESC(0x3F) {
+            g_warning("TFlowCtrlCli: [%s] is busy - %s dropped (%lu total)",
+                srv_name.c_str(), cmd, out_dropped);
+        }
+        rejectReq(mg_req, cmd, EBUSY, "module is busy");
+        return false;
+    }
+
+    out_q_bytes += msg.length();
+    out_q.push_back({ .key = std::move(key), .msg = std::move(msg), .seq = seq });
+
+    if (out_q.size() == 1) {
+        g_source_modify_unix_fd((GSource*)sck_src, sck_tag, (GIOCondition)(TFLOWCTRLCLI_SCK_EVENTS | G_IO_OUT));
+    }
+    return true;
+}
+
+void TFlowCtrlCli::flushOutQueue()
+{
+    while (!out_q.empty()) {
+        out_msg &q = out_q.front();
+
+        int rc = sendRaw(q.msg);
+        if (rc == 0) return;        // Still full - wait for the next G_IO_OUT
+        if (rc < 0 && rc != -EMSGSIZE) {
+            g_warning("TFlowCtrlCli: Send message error to [%s] (%d) - %s",
+                srv_name.c_str(), -rc, strerror(-rc));
+            onConnLost();
+            return;
+        }
+        if (rc < 0) {
+            g_warning("TFlowCtrlCli: [%s] message is too big (%zu) - dropped",
+                srv_name.c_str(), q.msg.length());
+        }
+
+        out_q_bytes -= q.msg.length();
+        out_q.pop_front();
+    }
+
+    g_source_modify_unix_fd((GSource*)sck_src, sck_tag, TFLOWCTRLCLI_SCK_EVENTS);
+}
 
-    if (sck_state_flag.v != Flag::SET) return 0;
+int TFlowCtrlCli::sendMsgToCtrl(const char *cmd, const json11::Json::object &j_params,
+    const TFlowReqId &mg_req)
+{
+    if (!isConnected()) return 0;
     
+    int seq = ++msg_seq_num;
+
     json11::Json j_msg = json11::Json::object{
         { "cmd"    , cmd      },
         { "dir"    , "request"},        // For better log readability only
+        { "seq"    , seq      },        // Echoed back by the module
         { "params" , j_params }
     };
 
     std::string s_msg = j_msg.dump();
 
-    res = send(sck_fd, s_msg.c_str(), s_msg.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
-    int err = errno;
-    if (res == -1) {
-        if (err == EPIPE) {
+    // Once something is queued, the rest goes after it to keep the order
+    int rc = out_q.empty() ? sendRaw(s_msg) : 0;
+    if (rc == -EMSGSIZE) {
+        g_warning("TFlowCtrlCli: [%s] %s is too big (%zu)", srv_name.c_str(), cmd, s_msg.length());
+        rejectReq(mg_req, cmd, EMSGSIZE, "message is too big");
+        return -1;
+    }
+    if (rc < 0) {
+        if (rc == -EPIPE) {
             g_warning("TFlowCtrlCli: Can't send");
         }
         else {
             g_warning("TFlowCtrlCli: Send message error to [%s], %s (%d) - %s",
-                srv_name.c_str(), cmd, err, strerror(err));
+                srv_name.c_str(), cmd, -rc, strerror(-rc));
         }
-        sck_state_flag.v = Flag::FALL;
-        last_idle_check_tp = { 0 }; // aka Idle loop kick - TODO: rework for "connect to idle once"
+        onConnLost();
         return -1;
     }
-    g_info("TFlowCtrlCli: [%s] ->> [%s]  %s", 
-        my_cli_name.c_str(), srv_name.c_str(), cmd);
+    if (rc == 0) {
+        std::string key;
+        if (isCoalescedCmd(cmd)) {
+            key = cmd;
+            for (auto &p : j_params) key.append(1, '\0').append(p.first);
+        }
+        if (!queueMsg(cmd, key, s_msg, seq, mg_req)) return -1;
+    }
+
+    g_info("TFlowCtrlCli: [%s] ->> [%s]  %s #%d%s", 
+        my_cli_name.c_str(), srv_name.c_str(), cmd, seq, rc ? "" : " (queued)");
 
     clock_gettime(CLOCK_MONOTONIC, &last_send_tp);
+
+    // Pongs are matched by ping_seq, see onPong()
+    if (0 == strcmp(cmd, "ping")) return 0;
     
-    // TODO: Mark pending response flag?
-    // ???
+    // Forget requests the module never responded to
+    if (pending_reqs.size() >= TFLOWCTRLCLI_MAX_PENDING) {
+        pending_reqs.pop_front();
+    }
+    const TFlowControl::route *route = TFlowControl::findRespRoute(srv_id, cmd, strlen(cmd));
+    pending_reqs.push_back({ .seq = seq, .mg_req = mg_req, .send_tp = last_send_tp,
+        .ui_name = route ? route->ui_name : nullptr });
 
     return 0;
 }
 
+// Fire-and-forget message. It has no "seq" and the module must not respond.
+// If the module is busy only the latest message of the kind is kept.
+int TFlowCtrlCli::sendEventToCtrl(const char *cmd, const char *j_params)
+{
+    if (!isConnected()) return -1;
+
+    std::string s_msg;
+    s_msg.append("{\"cmd\":\"").append(cmd)
+        .append("\",\"dir\":\"event\",\"params\":").append(j_params).append("}");
+
+    int rc = out_q.empty() ? sendRaw(s_msg) : 0;
+    if (rc < 0 && rc != -EMSGSIZE) {
+        g_warning("TFlowCtrlCli: Send message error to [%s], %s (%d) - %s",
+            srv_name.c_str(), cmd, -rc, strerror(-rc));
+        onConnLost();
+        return -1;
+    }
+    if (rc == 0) {
+        std::string key(cmd);
+        if (!queueMsg(cmd, key, s_msg, 0, TFlowReqId())) return -1;
+    }
+    return 0;
+}
+
 int TFlowCtrlCli::sendSignature()
 {
     json11::Json::object j_params = { 
@@ -320,6 +668,24 @@ int TFlowCtrlCli::sendSignature()
 
 void TFlowCtrlCli::Disconnect()
 {
+    // Responses won't come. Requests not answered by onConnLost() are timed
+    // out by Mongoose.
+    pending_reqs.clear();
+    seq_echo = false;
+    in_msg_peek = false;
+    chunked_msg.clear();
+    out_q.clear();
+    out_q_bytes = 0;
+
+    if (ping_src) {
+        g_source_destroy(ping_src);
+        g_source_unref(ping_src);
+        ping_src = nullptr;
+    }
+    ping_seq = 0;
+    pong_seen = false;
+    pong_missed = 0;
+
     if (sck_fd != -1) {
         close(sck_fd);
         sck_fd = -1;
@@ -381,52 +747,159 @@ int TFlowCtrlCli::Connect()
     /* Assign g_source on the socket */
     sck_gsfuncs.dispatch = tflow_ctrl_cli_dispatch;
     sck_src = (GSourceCli*)g_source_new(&sck_gsfuncs, sizeof(GSourceCli));
-    sck_tag = g_source_add_unix_fd((GSource*)sck_src, sck_fd, (GIOCondition)(G_IO_IN /* | G_IO_ERR  | G_IO_HUP */));
+    sck_tag = g_source_add_unix_fd((GSource*)sck_src, sck_fd, TFLOWCTRLCLI_SCK_EVENTS);
     sck_src->cli = this;
     g_source_attach((GSource*)sck_src, app->context);
 
     return 0;
 }
 
-void TFlowCtrlCli::onIdle(struct timespec* now_tp)
+static gboolean tflow_ctrl_cli_reconnect(gpointer user_data)
+{
+    TFlowCtrlCli* cli = (TFlowCtrlCli*)user_data;
+
+    cli->onReconnect();
+    return G_SOURCE_REMOVE;
+}
+
+// Exponential backoff with jitter, so modules restarted together aren't 
+// hammered in lockstep. The first attempt after losing a module that was 
+// talking to us is immediate.
+void TFlowCtrlCli::scheduleReconnect()
 {
+    if (reconnect_src) return;
+
+    int delay_msec = 0;
+    if (reconnect_backoff_msec) {
+        delay_msec = reconnect_backoff_msec / 2 +
+            g_random_int_range(0, reconnect_backoff_msec / 2 + 1);
+        reconnect_backoff_msec = std::min(reconnect_backoff_msec * 2, app->cfg.reconnect_max_msec);
+    }
+    else {
+        reconnect_backoff_msec = app->cfg.reconnect_min_msec;
+    }
 
-    double dt = diff_timespec_msec(now_tp, &last_idle_check_tp);
+    reconnect_src = g_timeout_source_new(delay_msec);
+    g_source_set_callback(reconnect_src, (GSourceFunc)tflow_ctrl_cli_reconnect, this, nullptr);
+    g_source_attach(reconnect_src, app->context);
+}
 
-    /* Do not check to often*/
-    if (dt < 3000) return;
-    last_idle_check_tp = *now_tp;
+static gboolean tflow_ctrl_cli_ping(gpointer user_data)
+{
+    TFlowCtrlCli* cli = (TFlowCtrlCli*)user_data;
 
-    if (sck_state_flag.v == Flag::SET || sck_state_flag.v == Flag::CLR) {
+    cli->onPing();
+    return G_SOURCE_CONTINUE;
+}
 
-        // Check idle connection
-        if (diff_timespec_msec(&last_send_tp, now_tp) > 1000) {
-            // sendPing();
+void TFlowCtrlCli::onPing()
+{
+    // Legacy module answers in the order of requests - an unknown "ping" it
+    // ignores would shift all later responses
+    if (!seq_echo) return;
+
+    if (ping_seq) {
+        pong_missed++;
+        pong_missed_total++;
+
+        // Modules that never answered a ping can't be judged
+        if (pong_seen && pong_missed >= app->cfg.ping_max_missed && conn_state == CONN_UP) {
+            g_warning("TFlowCtrlCli: [%s] module stalled - %d pings unanswered",
+                srv_name.c_str(), pong_missed);
+            setState(CONN_STALLED);
         }
-        return;
     }
 
-    if (sck_state_flag.v == Flag::UNDEF || sck_state_flag.v == Flag::RISE) {
-        int rc;
+    // Keep pinging while stalled - a late pong brings the module back
+    if (0 == sendMsgToCtrl("ping", json11::Json::object())) {
+        ping_seq = msg_seq_num;
+        ping_send_tp = last_send_tp;
+    }
+}
 
-        rc = Connect();
-        if (rc) {
-            sck_state_flag.v = Flag::RISE;
-        }
-        else {
-            sck_state_flag.v = Flag::SET;
-            sendSignature();
-        }
+void TFlowCtrlCli::onPong(int seq)
+{
+    // Round trip is known for the last ping only. A late pong to an earlier
+    // one still proves the module is alive.
+    if (seq == ping_seq) {
+        struct timespec now_tp;
+        clock_gettime(CLOCK_MONOTONIC, &now_tp);
+        ping_rtt_msec = diff_timespec_msec(&now_tp, &ping_send_tp);
+
+        TFlowHist *hist = app->metrics.moduleHist(srv_name.c_str(), "ping");
+        if (hist) hist->add((uint64_t)(ping_rtt_msec * 1000));
+    }
+    pong_seen = true;
+    pong_missed = 0;
+    if (seq >= ping_seq) ping_seq = 0;
+
+    if (conn_state == CONN_STALLED) {
+        g_info("TFlowCtrlCli: [%s] module is back (%.1f ms)", srv_name.c_str(), ping_rtt_msec);
+        setState(CONN_UP);
+    }
+}
+
+void TFlowCtrlCli::onReconnect()
+{
+    g_source_unref(reconnect_src);
+    reconnect_src = nullptr;
+
+    if (Connect()) {
+        setState(CONN_RETRY);
+        scheduleReconnect();
         return;
     }
 
-    if (sck_state_flag.v == Flag::FALL) {
-        // Connection aborted.
-        // Most probably TFlow Ctrl Server is closed
-        Disconnect();
+    setState(CONN_UP);
+    sendSignature();
 
-        // Try to reconnect
-        sck_state_flag.v = Flag::RISE;
+    if (app->cfg.ping_interval_msec && isConnected()) {
+        ping_src = g_timeout_source_new(app->cfg.ping_interval_msec);
+        g_source_set_callback(ping_src, (GSourceFunc)tflow_ctrl_cli_ping, this, nullptr);
+        g_source_attach(ping_src, app->context);
     }
+}
+
+// Connection is dead - release it and try to reconnect right away
+void TFlowCtrlCli::onConnLost()
+{
+    if (!isConnected()) return;
+
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    getsockopt(sck_fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    g_warning("TFlowCtrlCli: [%s] connection lost%s%s", srv_name.c_str(),
+        err ? " - " : "", err ? strerror(err) : "");
+
+    // Don't let the Web UI wait for responses that won't come
+    for (auto &req : pending_reqs) {
+        if (req.mg_req.conn_id == 0 || req.ui_name == nullptr) continue;
+
+        app->tflow_mg->sendMsgToMg(json11::Json::object({
+            { req.ui_name, json11::Json::object({ { "state", "off" } }) } }), req.mg_req);
+    }
+
+    Disconnect();
+    setState(CONN_RETRY);
+    scheduleReconnect();
+}
+
+void TFlowCtrlCli::setState(enum conn_state new_state)
+{
+    static const char *names[] = { "idle", "retry", "up", "stalled" };
+
+    if (new_state == conn_state) return;
+
+    g_info("TFlowCtrlCli: [%s] %s -> %s", srv_name.c_str(),
+        names[conn_state], names[new_state]);
+    conn_state = new_state;
+}
+
+void TFlowCtrlCli::Start()
+{
+    if (conn_state != CONN_IDLE) return;
 
+    reconnect_backoff_msec = 0;
+    setState(CONN_RETRY);
+    scheduleReconnect();
 }
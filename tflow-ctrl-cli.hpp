@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <deque>
 #include <time.h>
 
 #include <glib-unix.h>
@@ -8,27 +9,70 @@
 
 #define TFLOWCTRLSRV_SOCKET_NAME_BASE "_com.reedl.tflow.ctrl-server-"   // leading '_' will be replaced in real socket name
 
+// Messages exceeding SEQPACKET size limit are sent by modules as a sequence 
+// of chunks. Each chunk is a separate SEQPACKET message starting with the 
+// header below and followed by a part of the JSON message.
+#define TFLOWCTRL_CHUNK_MAGIC "TFCK"
+struct tflow_ctrl_chunk_hdr {
+    char magic[4];          // TFLOWCTRL_CHUNK_MAGIC
+    uint32_t total;         // Whole message length
+    uint32_t offset;        // Position of the chunk in the message
+};
+
 class TFlowControl;
       
 class TFlowCtrlCli {
 public:
-    TFlowCtrlCli(TFlowControl* app, const char *srv_name);
+    TFlowCtrlCli(TFlowControl* app, int srv_id, const char *srv_name);
 
     ~TFlowCtrlCli();
     
     TFlowControl* app;
 
-    void onIdle(struct timespec* now_tp);
+    void Start();
     int Connect();
 
     void Disconnect();
+    void onConnLost();
+    void onReconnect();
     int onCtrlMsg();
+    int onCtrlMsgs();
+    void flushOutQueue();
 
-    int sendMsgToCtrl(const char *cmd, const json11::Json::object &params);
-    int sendSignature();
+    int dispatch_budget;        // Max messages received per dispatch
 
-    int sck_fd;                 // +
-    Flag sck_state_flag;        // +
+    int sendMsgToCtrl(const char *cmd, const json11::Json::object &params,
+        const TFlowReqId &mg_req = TFlowReqId());
+    int sendEventToCtrl(const char *cmd, const char *params);
+    int sendSignature();
+    void rejectReq(const TFlowReqId &mg_req, const char *cmd, int err, const char *err_msg);
+    static bool isCoalescedCmd(const char *cmd);
+
+    // Connection state machine:
+    //   IDLE --Start()--> RETRY --Connect() ok--> UP
+    //   UP --HUP/ERR or recv/send failure--> RETRY (first attempt is immediate)
+    //   RETRY --Connect() failed--> RETRY (backoff)
+    //   UP --ping_max_missed pongs missed--> STALLED --pong--> UP
+    //   STALLED --HUP/ERR or recv/send failure--> RETRY
+    enum conn_state {
+        CONN_IDLE    = 0,           // Not started
+        CONN_RETRY   = 1,           // Disconnected, reconnect is scheduled
+        CONN_UP      = 2,           // Connected - requests are passed to the module
+        CONN_STALLED = 3,           // Connected, but the module doesn't respond
+    };
+
+    int sck_fd;
+    enum conn_state conn_state = CONN_IDLE;
+    bool isUp() const { return conn_state == CONN_UP; }
+    bool isConnected() const { return conn_state == CONN_UP || conn_state == CONN_STALLED; }
+
+    // Heartbeat. Any response to "ping", even an error, is a pong - it
+    // proves module's main loop is alive. Only modules echoing "seq" are
+    // pinged, legacy ones would pair the pongs with the wrong requests.
+    void onPing();
+    double ping_rtt_msec = 0;           // Last round trip
+    int pong_missed = 0;                // Pings in a row left unanswered
+    unsigned long pong_missed_total = 0;
 
     typedef struct
     {
@@ -44,18 +88,65 @@ private:
 
     std::string my_cli_name = "Control";
 
+    int srv_id;                     // TFlowControl::SRV_NAME
     std::string srv_name;
-    struct timespec last_idle_check_tp = { 0 };
+
+    GSource *reconnect_src = nullptr;   // Pending reconnect attempt
+    int reconnect_backoff_msec = 0;     // 0 - next attempt is immediate
+
+    void scheduleReconnect();
+    void setState(enum conn_state new_state);
+
+    GSource *ping_src = nullptr;        // Heartbeat timer, runs while connected
+    int ping_seq = 0;                   // Last ping sent, 0 - answered
+    struct timespec ping_send_tp;       // Pings are not in pending_reqs
+    bool pong_seen = false;             // Module answers pings at all
+
+    void onPong(int seq);
+
+    // Requests the module's socket couldn't take yet, oldest first. 
+    // Drained on G_IO_OUT. A queued request superseded by a newer one with
+    // the same key is replaced in place.
+    struct out_msg {
+        std::string key;            // Coalescing key, empty - never coalesced
+        std::string msg;
+        int seq;
+    };
+    std::deque<out_msg> out_q;
+    size_t out_q_bytes = 0;
+    unsigned long out_coalesced = 0;
+    unsigned long out_dropped = 0;
+
+    int sendRaw(const std::string &msg);
+    bool queueMsg(const char *cmd, std::string &key, std::string &msg,
+        int seq, const TFlowReqId &mg_req);
 
     int msg_seq_num = 0;
 
+    // Requests waiting for the module response, oldest first.
+    struct pending_req {
+        int seq;                    // "seq" sent to the module
+        TFlowReqId mg_req;          // Originator. conn_id 0 - TFlowControl itself
+        struct timespec send_tp;
+        const char *ui_name;        // UI module to report "off" to, if the module is lost
+    };
+    std::deque<pending_req> pending_reqs;
+    bool seq_echo = false;          // Module echoes "seq" back in responses
+
     size_t in_msg_size;
     char *in_msg;
+    bool in_msg_peek = false;       // Module sent a message bigger than in_msg
+    void growInMsg(size_t len);
+    std::string chunked_msg;        // Message being reassembled from chunks
 
     struct timespec last_send_tp = { 0 };
 
-    int onCtrlMsgParse(const char* msg);
+    int onCtrlMsgParse(const char* msg, size_t len);
+    int onCtrlMsgChunk(const char* msg, size_t len);
+    bool takePendingReq(bool has_seq, int seq, pending_req &req);
     void onCtrlMsgParseSaveCfgID(const char* msg, int new_id);
+    void sendRespToMg(const std::string &prefix, struct mg_str params, const char *suffix,
+        const TFlowReqId &mg_req, bool cfg_changed);
 
     // Parent module callback;
     std::function<void(TFlowCtrlCli *cli, const char *cmd, 
@@ -0,0 +1,211 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib-unix.h>
+
+#include "tflow-common.hpp"
+#include "tflow-metrics.hpp"
+
+static const char *hop_names[TFlowMetrics::HOP_NUM] = {
+    "mg_rx", "dispatch", "reply", "total", "joystick" };
+
+static const struct {
+    double q;
+    const char *name;
+} quantiles[] = { { 0.5, "0.5" }, { 0.9, "0.9" }, { 0.99, "0.99" }, { 0.999, "0.999" } };
+
+static void appendf(std::string &out, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (n > 0) out.append(buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+// Command names come from modules and may hold any character
+static void appendJsonStr(std::string &out, const std::string &s)
+{
+    out.append(1, '"');
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') out.append(1, '\\').append(1, c);
+        else if (c < 0x20) appendf(out, "\\u%04x", c);
+        else out.append(1, c);
+    }
+    out.append(1, '"');
+}
+
+// Prometheus text format escapes only backslash, double quote and newline
+static void appendLabel(std::string &out, const char *name, const std::string &s)
+{
+    out.append(name).append("=\"");
+    for (char c : s) {
+        if (c == '"' || c == '\\') out.append(1, '\\').append(1, c);
+        else if (c == '\n') out.append("\\n");
+        else out.append(1, c);
+    }
+    out.append(1, '"');
+}
+
+int TFlowHist::bucketIdx(uint64_t usec)
+{
+    if (usec < (1 << SUB_BITS)) return (int)usec;
+
+    int msb = 63 - __builtin_clzll(usec);
+    if (msb > 31) return BUCKETS - 1;
+
+    int sub = (int)(usec >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return ((msb - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+uint64_t TFlowHist::bucketTop(int idx)
+{
+    if (idx < (1 << SUB_BITS)) return idx;
+
+    int msb = (idx >> SUB_BITS) + SUB_BITS - 1;
+    int sub = idx & ((1 << SUB_BITS) - 1);
+    return ((uint64_t)((1 << SUB_BITS) + sub + 1) << (msb - SUB_BITS)) - 1;
+}
+
+void TFlowHist::add(uint64_t usec)
+{
+    // Single writer - no need for read-modify-write atomics
+    std::atomic<uint32_t> &b = buckets[bucketIdx(usec)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    sum.store(sum.load(std::memory_order_relaxed) + usec, std::memory_order_relaxed);
+    if (usec > max.load(std::memory_order_relaxed)) {
+        max.store(usec, std::memory_order_relaxed);
+    }
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void TFlowHist::snapshot(struct snap *s) const
+{
+    s->count = count.load(std::memory_order_acquire);
+    s->sum = sum.load(std::memory_order_relaxed);
+    s->max = max.load(std::memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; i++) {
+        s->buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t TFlowHist::percentile(const struct snap &s, double q)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) total += s.buckets[i];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(q * total + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t acc = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        acc += s.buckets[i];
+        if (acc >= rank) {
+            uint64_t top = bucketTop(i);
+            return top < s.max ? top : s.max;
+        }
+    }
+    return s.max;
+}
+
+TFlowHist* TFlowMetrics::moduleHist(const char *srv, const char *cmd)
+{
+    std::string key = std::string(srv) + "/" + cmd;
+
+    auto it = cmds_idx.find(key);
+    if (it != cmds_idx.end()) {
+        return it->second;
+    }
+
+    int n = cmds_num.load(std::memory_order_relaxed);
+    if (n == MAX_CMDS) {
+        PRESC(0xFF) {
+            g_warning("TFlowMetrics: too many commands - [%s] %s isn't tracked", srv, cmd);
+        }
+        return nullptr;
+    }
+
+    cmd_hist &h = cmds[n];
+    h.srv = srv;
+    h.cmd = cmd;
+
+    // Publish the entry to readers
+    cmds_num.store(n + 1, std::memory_order_release);
+
+    cmds_idx.emplace(key, &h.hist);
+    return &h.hist;
+}
+
+void TFlowMetrics::dumpJson(std::string &out) const
+{
+    TFlowHist::snap s;
+    int n = cmds_num.load(std::memory_order_acquire);
+
+    out.append("{\"metrics\":[");
+    for (int i = 0; i < HOP_NUM + n; i++) {
+        if (i < HOP_NUM) {
+            hops[i].snapshot(&s);
+            appendf(out, "%s{\"hop\":\"%s\"", i ? "," : "", hop_names[i]);
+        }
+        else {
+            const cmd_hist &h = cmds[i - HOP_NUM];
+            h.hist.snapshot(&s);
+            out.append(",{\"hop\":\"module\",\"srv\":");
+            appendJsonStr(out, h.srv);
+            out.append(",\"cmd\":");
+            appendJsonStr(out, h.cmd);
+        }
+
+        appendf(out, ",\"count\":%llu,\"mean_us\":%llu",
+            (unsigned long long)s.count,
+            (unsigned long long)(s.count ? s.sum / s.count : 0));
+        appendf(out, ",\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu",
+            (unsigned long long)TFlowHist::percentile(s, 0.5),
+            (unsigned long long)TFlowHist::percentile(s, 0.9),
+            (unsigned long long)TFlowHist::percentile(s, 0.99),
+            (unsigned long long)TFlowHist::percentile(s, 0.999));
+        appendf(out, ",\"max_us\":%llu}", (unsigned long long)s.max);
+    }
+    out.append("]}\n");
+}
+
+void TFlowMetrics::dumpPrometheus(std::string &out) const
+{
+    TFlowHist::snap s;
+    std::string labels;
+    int n = cmds_num.load(std::memory_order_acquire);
+
+    out.append("# HELP tflow_latency_seconds TFlow control path latency per hop\n");
+    out.append("# TYPE tflow_latency_seconds summary\n");
+
+    for (int i = 0; i < HOP_NUM + n; i++) {
+        if (i < HOP_NUM) {
+            hops[i].snapshot(&s);
+            labels.assign("hop=\"").append(hop_names[i]).append(1, '"');
+        }
+        else {
+            const cmd_hist &h = cmds[i - HOP_NUM];
+            h.hist.snapshot(&s);
+            labels.assign("hop=\"module\",");
+            appendLabel(labels, "srv", h.srv);
+            labels.append(1, ',');
+            appendLabel(labels, "cmd", h.cmd);
+        }
+
+        // Labels may be longer than appendf() takes
+        for (auto &q : quantiles) {
+            out.append("tflow_latency_seconds{").append(labels);
+            appendf(out, ",quantile=\"%s\"} %.6f\n", q.name, TFlowHist::percentile(s, q.q) / 1e6);
+        }
+        out.append("tflow_latency_seconds_sum{").append(labels);
+        appendf(out, "} %.6f\n", s.sum / 1e6);
+        out.append("tflow_latency_seconds_count{").append(labels);
+        appendf(out, "} %llu\n", (unsigned long long)s.count);
+    }
+}
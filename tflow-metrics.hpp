@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t tflow_now_usec()
+{
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+/*
+ * Latency histogram with log-linear buckets (HDR style) - 4 sub-buckets per
+ * power of two, i.e. values are kept with ~12% precision from 1 usec up to
+ * ~70 min.
+ * Single writer. Readers in other threads may see a slightly inconsistent
+ * snapshot, which is fine for metrics.
+ */
+class TFlowHist {
+public:
+    static constexpr int SUB_BITS = 2;
+    static constexpr int BUCKETS  = 31 << SUB_BITS;
+
+    struct snap {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint32_t buckets[BUCKETS];
+    };
+
+    void add(uint64_t usec);
+    void snapshot(struct snap *s) const;
+    static uint64_t percentile(const struct snap &s, double q);
+
+private:
+    static int bucketIdx(uint64_t usec);
+    static uint64_t bucketTop(int idx);
+
+    std::atomic<uint64_t> count {0};
+    std::atomic<uint64_t> sum {0};
+    std::atomic<uint64_t> max {0};
+    std::atomic<uint32_t> buckets[BUCKETS] = {};
+};
+
+/*
+ * Control path latency per hop:
+ *   mg_rx    - Mongoose has the HTTP request -> the request is in the ring
+ *   dispatch - the request is in the ring -> TFlow has handled it
+ *   module   - sendMsgToCtrl -> module response, per TFlow module and command
+ *   reply    - response is in the ring -> HTTP reply is sent
+ *   total    - Mongoose has the HTTP request -> HTTP reply is sent
+ *   joystick - Mongoose has the WebSocket frame -> it is sent to the module
+ */
+class TFlowMetrics {
+public:
+    enum HOP {
+        HOP_MG_RX    = 0,       // Mongoose thread
+        HOP_DISPATCH = 1,       // TFlow thread
+        HOP_REPLY    = 2,       // Mongoose thread
+        HOP_TOTAL    = 3,       // Mongoose thread
+        HOP_JOY      = 4,       // TFlow thread
+        HOP_NUM      = 5
+    };
+
+    TFlowHist hops[HOP_NUM];
+
+    // TFlow thread only. Returns nullptr if there are too many commands.
+    TFlowHist* moduleHist(const char *srv, const char *cmd);
+
+    // Any thread
+    void dumpJson(std::string &out) const;
+    void dumpPrometheus(std::string &out) const;
+
+private:
+    static constexpr int MAX_CMDS = 64;
+
+    struct cmd_hist {
+        std::string srv;                // As the module sent it, escaped on output
+        std::string cmd;
+        TFlowHist hist;
+    };
+    cmd_hist cmds[MAX_CMDS];
+    std::atomic<int> cmds_num {0};      // Published entries
+
+    std::unordered_map<std::string, TFlowHist*> cmds_idx;   // TFlow thread only
+};
@@ -1,6 +1,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 
 #include <glib-unix.h>
 
@@ -9,6 +12,14 @@
 #include "tflow-control.hpp"
 #include "tflow-mg.hpp"
 
+// Ring, backlog and buffer sizes, timeouts, listeners and paths are in
+// TFlowSettings
+#define TFLOW_MG_MAX_MSG_PARTS      4                    // Pieces of a serialized message
+#define TFLOW_MG_WAKEUP_TLS         "tls"                // Reload TLS credentials
+
+static_assert(TFLOW_MG_PART_SIZE + sizeof(TFlowMg::mg_msg_hdr) <= TFLOW_SETTINGS_MIN_RING_SIZE / 2 - sizeof(uint64_t),
+    "Part must fit into an empty ring at any offset");
+
 struct user {
   const char *name, *pass, *access_token;
 };
@@ -21,9 +32,6 @@ struct settings {
   char *device_name;
 };
 
-static char tflow_mg_in[1024 * 1024];      // Buffer for messages from TFlowMG to MG
-static char tflow_mg_out[1024 * 1024];      // Buffer for messages from MG to TFlowMG 
-
 static struct settings s_settings = {true, 1, 57, NULL};
 
 static const char *s_json_header =
@@ -91,73 +99,273 @@ static size_t print_int_arr(void (*out)(char, void *), void *ptr, va_list *ap) {
   return len;
 }
 
-void TFlowMg::_wait_and_reply_tflow_response(struct mg_connection* c, struct mg_data* my_data)
+void TFlowMg::_api_request(struct mg_connection* c, struct mg_data* my_data, struct mg_str body, uint64_t rx_us)
 {
-    ssize_t bytes_flush;
-    do {
-        bytes_flush = read(my_data->rd_fd, tflow_mg_in, sizeof(tflow_mg_in) - 1);
-    } while (bytes_flush == sizeof(tflow_mg_in) - 1);
-
-    // Wait for response with timeout
-    struct pollfd waiter = { .fd = my_data->rd_fd, .events = POLLIN };
-    int poll_res = poll(&waiter, 1, 3 * 1000);
-
-    switch (poll_res) {   // 1sec
-    case 0:
-        mg_http_reply(c, 408, "", "TFlow doesn't respond\n");
-        break;
-    case 1:
-        if (waiter.revents & POLLIN) {
-            ssize_t bytes_read = read(my_data->rd_fd, tflow_mg_in, sizeof(tflow_mg_in) - 1);
-            if (bytes_read < 0) {
-                mg_http_reply(c, 403, "", "Denied on read\n");
-                break;
-            }
-            tflow_mg_in[bytes_read] = '\0';
+    struct mg_conn_state *state = (struct mg_conn_state*)c->data;
+    struct mg_msg_hdr hdr = { .conn_id = c->id, .seq = ++my_data->req_seq, .len = body.len, .ts_us = tflow_now_usec() };
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void*)body.ptr, .iov_len = body.len } };
+
+    // Such a request may never fit into the ring, however long it waits
+    if (sizeof(hdr) + body.len > my_data->wr_ring->maxMsgSize()) {
+        mg_http_reply(c, 413, "", "Request is too big\n");
+        return;
+    }
+
+    bool was_empty;
+    if (!my_data->wr_ring->push(iov, 2, &was_empty)) {
+        mg_http_reply(c, 503, "", "TFlow is busy\n");
+        return;
+    }
+    if (was_empty) {
+        eventfd_write(my_data->wr_evfd, 1);
+    }
+    my_data->metrics->hops[TFlowMetrics::HOP_MG_RX].add(hdr.ts_us - rx_us);
+
+    // Park the connection until TFlow responds or the timeout triggers.
+    // The response is delivered via MG_EV_WAKEUP from the TFlow thread.
+    state->mark = 'A';
+    state->api_seq = hdr.seq;
+    state->api_start_us = rx_us;
+    state->api_deadline = mg_millis() + my_data->cfg->api_timeout_msec;
+}
+
+// Joystick frames skip JSON and the request/response round trip - straight
+// into the ring, TFlow forwards the latest one to the module.
+void TFlowMg::_joy_frame(struct mg_connection* c, struct mg_data* my_data, struct mg_str data)
+{
+    if (data.len != sizeof(struct joy_frame) || (uint8_t)data.ptr[0] != joy_frame::MAGIC) {
+        MG_DEBUG(("%lu bad joystick frame (%lu bytes)", c->id, (unsigned long)data.len));
+        return;
+    }
 
-            mg_http_reply(c, 200, s_json_header, "%s\n", tflow_mg_in);
-            memset(tflow_mg_in, 0, sizeof(tflow_mg_in));
-            break;
+    struct mg_msg_hdr hdr = { .conn_id = c->id, .flags = mg_msg_hdr::JOY, .len = data.len, .ts_us = tflow_now_usec() };
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void*)data.ptr, .iov_len = data.len } };
+
+    bool was_empty;
+    if (!my_data->wr_ring->push(iov, 2, &was_empty)) {
+        // TFlow is busy - a newer frame will follow
+        my_data->joy_dropped++;
+        return;
+    }
+    if (was_empty) {
+        eventfd_write(my_data->wr_evfd, 1);
+    }
+}
+
+// PEM -> DER, so mg_tls_init() only copies the credentials. 
+// DER input is taken as is.
+static bool pem_to_der(char *pem, size_t len, const char *label, struct mg_str *der)
+{
+    char begin[64], end[64];
+    snprintf(begin, sizeof(begin), "-----BEGIN %s-----", label);
+    snprintf(end, sizeof(end), "-----END %s-----", label);
+
+    char *b = strstr(pem, begin);
+    if (b == NULL) {
+        if (strstr(pem, "-----BEGIN ")) return false;   // Wrong PEM
+        *der = mg_str_n(pem, len);
+        return true;
+    }
+    b += strlen(begin);
+
+    char *e = strstr(b, end);
+    if (e == NULL) return false;
+
+    // Decode in place - base64 is longer than the data
+    size_t n = 0;
+    for (char *c = b; c < e; c++) {
+        if (*c != ' ' && *c != '\n' && *c != '\r' && *c != '\t') pem[n++] = *c;
+    }
+    n = mg_base64_decode(pem, n, pem, n);
+    if (n == 0) return false;
+
+    *der = mg_str_n(pem, n);
+    return true;
+}
+
+bool TFlowMg::_tls_load(struct mg_data* my_data)
+{
+    size_t cert_len = 0, key_len = 0;
+    char *cert = mg_file_read(&mg_fs_posix, my_data->cfg->tls_cert.c_str(), &cert_len);
+    char *key = mg_file_read(&mg_fs_posix, my_data->cfg->tls_key.c_str(), &key_len);
+    struct mg_str cert_der, key_der;
+
+    if (cert == NULL || key == NULL ||
+        !pem_to_der(cert, cert_len, "CERTIFICATE", &cert_der) ||
+        !pem_to_der(key, key_len, "EC PRIVATE KEY", &key_der)) {
+        // Keep the credentials loaded before, if any
+        MG_ERROR(("Can't load TLS credentials from %s, %s",
+            my_data->cfg->tls_cert.c_str(), my_data->cfg->tls_key.c_str()));
+        free(cert);
+        free(key);
+        return false;
+    }
+
+    free((void*)my_data->tls_cert.ptr);
+    free((void*)my_data->tls_key.ptr);
+    my_data->tls_cert = cert_der;
+    my_data->tls_key = key_der;
+    MG_INFO(("TLS credentials loaded"));
+    return true;
+}
+
+// Latency histograms as JSON or, with ?format=prometheus, as Prometheus text
+void TFlowMg::_metrics_request(struct mg_connection* c, struct mg_data* my_data, struct mg_http_message* hm)
+{
+    char format[16];
+    std::string out;
+
+    if (mg_http_get_var(&hm->query, "format", format, sizeof(format)) > 0 &&
+        0 == strcmp(format, "prometheus")) {
+        my_data->metrics->dumpPrometheus(out);
+        mg_http_reply(c, 200, "Content-Type: text/plain; version=0.0.4\r\n"
+            "Cache-Control: no-cache\r\n", "%.*s", (int)out.length(), out.c_str());
+        return;
+    }
+
+    my_data->metrics->dumpJson(out);
+    mg_http_reply(c, 200, s_json_header, "%.*s", (int)out.length(), out.c_str());
+}
+
+void TFlowMg::_ws_broadcast(struct mg_mgr* mgr, struct mg_data* my_data, struct mg_str msg)
+{
+    // Broadcast message to all connected websocket clients.
+    // Traverse over all connections
+    for (struct mg_connection* wc = mgr->conns; wc != NULL; wc = wc->next) {
+        // Send only to marked connections
+        if (wc->data[0] != 'W') continue;
+
+        // Don't let a slow client eat the memory
+        if (wc->send.len > my_data->cfg->ws_max_send) {
+            my_data->ws_dropped++;
+            MG_DEBUG(("%lu WS client is slow - push dropped (%lu total)",
+                wc->id, my_data->ws_dropped));
+            continue;
+        }
+        mg_ws_send(wc, msg.ptr, msg.len, WEBSOCKET_OP_TEXT);
+    }
+}
+
+void TFlowMg::_reply_tflow_response(struct mg_mgr* mgr, struct mg_data* my_data, 
+    const struct mg_msg_hdr &hdr, struct mg_str msg)
+{
+    if (hdr.conn_id == 0) {
+        // Unsolicited message from TFlow - push it to the UI.
+        // Big messages come in parts - collect them first.
+        if ((hdr.flags & mg_msg_hdr::MORE) || my_data->ws_msg.len) {
+            mg_iobuf_add(&my_data->ws_msg, my_data->ws_msg.len, msg.ptr, msg.len);
+            if (hdr.flags & mg_msg_hdr::MORE) return;
+
+            _ws_broadcast(mgr, my_data, mg_str_n((char*)my_data->ws_msg.buf, my_data->ws_msg.len));
+            mg_iobuf_free(&my_data->ws_msg);
+            return;
+        }
+        _ws_broadcast(mgr, my_data, msg);
+        return;
+    }
+
+    for (struct mg_connection* c = mgr->conns; c != NULL; c = c->next) {
+        if (c->id != hdr.conn_id) continue;
+
+        struct mg_conn_state *state = (struct mg_conn_state*)c->data;
+        if ((state->mark != 'A' && state->mark != 'S') || state->api_seq != hdr.seq) {
+            // The request is timed out and the connection may be reused
+            MG_DEBUG(("%lu /api #%d late response dropped", c->id, hdr.seq));
+            return;
         }
-        else if (waiter.revents & POLLERR) {
-            mg_http_reply(c, 403, "", "Denied on poll\n");
-            break;
+
+        if (state->mark == 'A' && (hdr.flags & (mg_msg_hdr::BAD_REQUEST | mg_msg_hdr::NOT_FOUND))) {
+            mg_http_reply(c, (hdr.flags & mg_msg_hdr::BAD_REQUEST) ? 400 : 404, "",
+                "%.*s\n", (int)msg.len, msg.ptr);
+        }
+        else if (state->mark == 'A' && !(hdr.flags & mg_msg_hdr::MORE)) {
+            mg_http_reply(c, 200, s_json_header, "%.*s\n", (int)msg.len, msg.ptr);
         }
-        else if (waiter.revents & POLLHUP) {
-            mg_http_reply(c, 403, "", "Denied - hup\n");
-            break;
+        else {
+            // Big response comes in parts - stream it as they arrive
+            if (state->mark == 'A') {
+                mg_printf(c, "HTTP/1.1 200 OK\r\n%sTransfer-Encoding: chunked\r\n\r\n", s_json_header);
+                state->mark = 'S';
+            }
+            mg_http_write_chunk(c, msg.ptr, msg.len);
+            state->api_deadline = mg_millis() + my_data->cfg->api_timeout_msec;
+
+            if (hdr.flags & mg_msg_hdr::MORE) return;
+
+            mg_http_write_chunk(c, "\n", 1);
+            mg_http_write_chunk(c, "", 0);      // End of the stream
         }
-        break;
-    default:
-        mg_http_reply(c, 403, "", "Denied - X3\n");
-        break;
+
+        state->mark = 0;
+
+        uint64_t now_us = tflow_now_usec();
+        my_data->metrics->hops[TFlowMetrics::HOP_REPLY].add(now_us - hdr.ts_us);
+        my_data->metrics->hops[TFlowMetrics::HOP_TOTAL].add(now_us - state->api_start_us);
+        MG_DEBUG(("%lu /api #%d replied in %llu us", c->id, hdr.seq,
+            (unsigned long long)(now_us - state->api_start_us)));
+        return;
     }
+}
+
+void TFlowMg::_on_tflow_msg(struct mg_connection* c, struct mg_data* my_data)
+{
+    const char *msg;
+    size_t len;
 
-    return;
+    // Dispatch all messages posted by TFlow so far right from the ring
+    while (my_data->rd_ring->peek(&msg, &len)) {
+        struct mg_msg_hdr hdr;
+        memcpy(&hdr, msg, sizeof(hdr));
+
+        _reply_tflow_response(c->mgr, my_data, hdr, mg_str_n(msg + sizeof(hdr), hdr.len));
+        my_data->rd_ring->pop();
+    }
+
+    // TFlow holds messages in its backlog - let it know there is room now
+    if (my_data->rd_ring->takeSpaceWaiter()) {
+        eventfd_write(my_data->wr_evfd, 1);
+    }
 }
 
 void TFlowMg::_on_msg(struct mg_connection* c, int ev, void* ev_data)
 {
-    // TODO: Cleanup. Remove WS socket related stuff
     struct mg_data *my_data = (struct mg_data* )c->fn_data;
 
     if (ev == MG_EV_OPEN && c->is_listening) {
         // Connection created
     }
     if (ev == MG_EV_ACCEPT) {
-        size_t cert_len = 0;
-        size_t key_len = 0;
-        struct mg_tls_opts opts = {
-            .cert = mg_file_read(&mg_fs_posix, "/home/root/cert/server.crt", &cert_len),
-            .key  = mg_file_read(&mg_fs_posix, "/home/root/cert/server.key", &key_len),
-            // .ca   = mg_file_read(&mg_fs_posix, "/home/root/cert/ca.crt", NULL)
-        };
-        opts.cert.len = cert_len;
-        opts.key.len = key_len;
-        mg_tls_init(c, &opts);
-  }
+        // Accepted connection inherits listener's address - find out 
+        // whether it came via TLS listener.
+        bool tls = false;
+        for (int i = 0; i < my_data->lsn_num; i++) {
+            if (0 == memcmp(&my_data->lsn[i].loc, &c->loc, sizeof(c->loc))) {
+                tls = my_data->lsn[i].tls;
+                break;
+            }
+        }
+
+        // Credentials are loaded once and shared by all connections
+        if (tls && my_data->tls_cert.len && my_data->tls_key.len) {
+            struct mg_tls_opts opts = { .cert = my_data->tls_cert, .key = my_data->tls_key,
+                .ktls = my_data->cfg->tls_ktls };
+            mg_tls_init(c, &opts);
+        }
+        else if (tls) {
+            // Never fall back to plain HTTP on an https:// listener
+            PRESC(0x3F) {
+                MG_ERROR(("%lu no TLS credentials - connection refused", c->id));
+            }
+            c->is_closing = 1;
+        }
+    }
     else if (ev == MG_EV_HTTP_MSG) {
         struct mg_http_message* hm = (struct mg_http_message*)ev_data;
+        uint64_t rx_us = tflow_now_usec();
         struct user *u = authenticate(hm);
 
         if (mg_http_match_uri(hm, "/websocket")) {
@@ -173,18 +381,20 @@ void TFlowMg::_on_msg(struct mg_connection* c, int ev, void* ev_data)
             handle_logout(c);
         }
 #endif
+        else if (mg_http_match_uri(hm, "/api/metrics")) {
+            _metrics_request(c, my_data, hm);
+        }
         else if ( mg_http_match_uri(hm, "/api") ) {
             
-            int res = write(my_data->wr_fd, hm->body.ptr, hm->body.len);
+            _api_request(c, my_data, hm->body, rx_us);
 #if CODE_BROWSE
             tflow_mg_fifo_dispatch();
                 TFlowMg::onMsgFromMg();
 #endif
-            _wait_and_reply_tflow_response(c, my_data);
         } 
         else {
             // Serve static files
-            struct mg_http_serve_opts opts = {.root_dir = "/home/root/web_root"};
+            struct mg_http_serve_opts opts = {.root_dir = my_data->cfg->web_root.c_str()};
             mg_http_serve_dir(c, (mg_http_message*)ev_data, &opts);
         }
     }
@@ -194,7 +404,12 @@ void TFlowMg::_on_msg(struct mg_connection* c, int ev, void* ev_data)
     else if (ev == MG_EV_WS_MSG) {
         // Got websocket frame. Received data is wm->data
         struct mg_ws_message* wm = (struct mg_ws_message*)ev_data;
-        mg_ws_send(c, wm->data.ptr, wm->data.len, WEBSOCKET_OP_TEXT);
+        if ((wm->flags & 0x0F) == WEBSOCKET_OP_BINARY) {
+            _joy_frame(c, my_data, wm->data);
+        }
+        else {
+            mg_ws_send(c, wm->data.ptr, wm->data.len, WEBSOCKET_OP_TEXT);
+        }
         mg_iobuf_del(&c->recv, 0, c->recv.len);
 #if 0
         mg_rpc_add(&s_rpc_head, mg_str("rpc.list"), mg_rpc_list, &s_rpc_head);
@@ -207,74 +422,76 @@ void TFlowMg::_on_msg(struct mg_connection* c, int ev, void* ev_data)
         mg_iobuf_free(&io);
 #endif
     }
-    else if (ev == MG_EV_WAKEUP) {
-        struct mg_str* data = (struct mg_str*)ev_data;
-        // Broadcast message to all connected websocket clients.
-        // Traverse over all connections
-        for (struct mg_connection* wc = c->mgr->conns; wc != NULL; wc = wc->next) {
-            // Send only to marked connections
-            if (wc->data[0] == 'W')
-                mg_ws_send(wc, data->ptr, data->len, WEBSOCKET_OP_TEXT);
+    else if (ev == MG_EV_POLL && c->id == my_data->lsn_id) {
+        // Fallback for a lost or delayed MG_EV_WAKEUP - the ring is cheap
+        // to check when empty
+        _on_tflow_msg(c, my_data);
+    }
+    else if (ev == MG_EV_POLL) {
+        struct mg_conn_state *state = (struct mg_conn_state*)c->data;
+        if (state->mark == 'A' && mg_millis() > state->api_deadline) {
+            MG_DEBUG(("%lu /api #%d timed out", c->id, state->api_seq));
+            mg_http_reply(c, 408, "", "TFlow doesn't respond\n");
+            state->mark = 0;
+        }
+        else if (state->mark == 'S' && mg_millis() > state->api_deadline) {
+            // Headers are sent already - the only way to report is to close
+            MG_DEBUG(("%lu /api #%d stream stalled", c->id, state->api_seq));
+            c->is_draining = 1;
+            state->mark = 0;
+        }
+    }
+    else if (ev == MG_EV_WAKEUP && c->id == my_data->lsn_id) {
+        struct mg_str *data = (struct mg_str*)ev_data;
+        if (0 == mg_vcmp(data, TFLOW_MG_WAKEUP_TLS)) {
+            // Resumed sessions skip the certificate. Forget the tickets issued
+            // under the old credentials, so clients do a full handshake.
+            if (_tls_load(my_data)) {
+                mg_tls_ctx_free(c->mgr);
+                mg_tls_ctx_init(c->mgr);
+            }
+            return;
         }
+        // TFlow has posted message(s) to the ring
+        _on_tflow_msg(c, my_data);
     }
 
 }
 
-int TFlowMg::onRequest(const json11::Json &j_msg)
+int TFlowMg::onRequest(const json11::Json &j_msg, const TFlowReqId &req_id)
 {
     json11::Json::object j_modules;
 
-    for (int i = 0; i < app->tflow_ctrl_clis.size(); i++) {
-        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(i);
+    // Report UI modules tracking the configuration
+    for (const TFlowControl::route *r = TFlowControl::routes; r->ui_name; r++) {
+        if (!(r->flags & TFlowControl::route::CFG_ID)) continue;
+
+        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(r->srv);
 
         json11::Json::object j_mod_params;
 
-        if (cli.sck_state_flag.v == Flag::SET) {
-            j_mod_params.emplace("state", "ok");
+        if (cli.isConnected()) {
+            j_mod_params.emplace("state", cli.isUp() ? "ok" : "stalled");
+
+            // Heartbeat - an overloaded module shows up here first
+            j_mod_params.emplace("rtt_ms", cli.ping_rtt_msec);
+            j_mod_params.emplace("pong_missed", cli.pong_missed);
+            j_mod_params.emplace("pong_missed_total", (double)cli.pong_missed_total);
         }
         else {
             j_mod_params.emplace("state", "off");
         }
     
-        std::unordered_map<std::string, int>::iterator it_cfg_id;
-
-        switch (i) {
-        case TFlowControl::SRV_NAME_CAPTURE: {
-            it_cfg_id = app->config_ids.find("capture");
-            if (it_cfg_id != app->config_ids.end()) {
-                j_mod_params.emplace("config_id", it_cfg_id->second);
-            }
-            j_modules.emplace("capture", j_mod_params);
-            break;
-        }
-        case TFlowControl::SRV_NAME_PROCESS:
-            it_cfg_id = app->config_ids.find("mvision");
-            if (it_cfg_id != app->config_ids.end()) {
-                j_mod_params.emplace("config_id", it_cfg_id->second);
-            }
-            j_modules.emplace( "mvision", j_mod_params);
-            break;
-        case TFlowControl::SRV_NAME_VSTREAM:
-            it_cfg_id = app->config_ids.find("recording");
-            if (it_cfg_id != app->config_ids.end()) {
-                j_mod_params.emplace("config_id", it_cfg_id->second);
-            }
-            j_modules.emplace("recording", j_mod_params);
-
-            it_cfg_id = app->config_ids.find("streaming");
-            if (it_cfg_id != app->config_ids.end()) {
-                j_mod_params.emplace("config_id", it_cfg_id->second);
-            }
-            j_modules.emplace( "streaming", j_mod_params);
-            break;
-        default:
-            assert(0);
+        auto it_cfg_id = app->config_ids.find(r->ui_name);
+        if (it_cfg_id != app->config_ids.end()) {
+            j_mod_params.emplace("config_id", it_cfg_id->second);
         }
-
+        j_modules.emplace(r->ui_name, j_mod_params);
     }
     
     //{ "control" : {
-    //        "capture"  : { "config_id" : 1 }, 
+    //        "capture"  : { "state" : "ok", "config_id" : 1, 
+    //                       "rtt_ms" : 0.4, "pong_missed" : 0, "pong_missed_total" : 0 }, 
     //        "mvision"  : { "config_id" : 2 }
     //        "streamer" : { "config_id" : 3 }
     //        "recorder" : { "config_id" : 4 }
@@ -284,247 +501,463 @@ int TFlowMg::onRequest(const json11::Json &j_msg)
     //const json11::Json::object j_control({ 
     //    { "control", j_modules } });
 
-    sendMsgToMg(json11::Json::object({ { "control", j_modules } }));
+    sendMsgToMg(json11::Json::object({ { "control", j_modules } }), req_id);
     return 0;
 }
 
 
-int TFlowMg::sendMsgToMg(const json11::Json::object &j_params)
+// Messages with req_id.conn_id == 0 are broadcast to WebSocket clients
+int TFlowMg::sendMsgToMg(const json11::Json::object &j_params, const TFlowReqId &req_id)
 {
     json11::Json j_msg = j_params;
 
     std::string j_msg_dump = j_msg.dump();
-    write(pipe_fd_tflow2mg[1], j_msg_dump.c_str(), j_msg_dump.length() + 1);
-    return 0;
+    struct iovec part = { .iov_base = (void*)j_msg_dump.c_str(), .iov_len = j_msg_dump.length() };
+
+    return sendMsgToMg(&part, 1, req_id);
 }
 
-int TFlowMg::onMsgFromMg()
+// The message is an already serialized JSON split into pieces, for ex.
+// envelope prefix, module's payload and envelope suffix. The pieces are 
+// glued together right in the ring.
+int TFlowMg::sendMsgToMg(const struct iovec *parts, int parts_num, const TFlowReqId &req_id,
+    int reply_flags)
 {
-    ssize_t res;
-    int err;
+    size_t msg_len = 0;
+    for (int i = 0; i < parts_num; i++) msg_len += parts[i].iov_len;
 
-    // Read-out all data from the mongoose pipe
-    res = read(pipe_fd_mg2tflow[0], &mg_in_msg, sizeof(mg_in_msg)-1);
-    err = errno;
+    if (msg_len > app->cfg.backlog_max_bytes) {
+        dropMsgToMg(msg_len, "too big");
+        return -1;
+    }
 
-    if (res <= 0) {
-        if (err == EPIPE || err == ECONNREFUSED || err == ENOENT) {
-            g_warning("TFlowMg: TFlow Mongoose closed");
-        }
-        else {
-            g_warning("TFlowMg: unexpected error (%ld, %d) - %s",
-                res, err, strerror(err));
-        }
+    // Keep the order - nothing passes the backlog. Once started, the message
+    // is never dropped in the middle.
+    if (!tflow2mg_backlog.empty() &&
+        tflow2mg_stats.backlog_bytes + msg_len > app->cfg.backlog_max_bytes) {
+        dropMsgToMg(msg_len, "backlog is full");
         return -1;
     }
 
-    mg_in_msg[res] = 0;
+    // Fast path - single part message goes straight to the ring
+    if (msg_len <= TFLOW_MG_PART_SIZE && tflow2mg_backlog.empty() &&
+        pushMsgToMg(req_id, reply_flags, parts, parts_num)) {
+        return 0;
+    }
 
-    // Parse input msg to Json. Pass Json to an approriated module
-    std::string j_err;
-    const json11::Json j_in_msg = json11::Json::parse(mg_in_msg, j_err);
+    std::string msg;
+    if (parts_num == 1) {
+        msg.assign((const char*)parts[0].iov_base, parts[0].iov_len);
+    }
+    else {
+        msg.reserve(msg_len);
+        for (int i = 0; i < parts_num; i++) msg.append((const char*)parts[i].iov_base, parts[i].iov_len);
+    }
 
-    if (j_in_msg.is_null()) {
-        snprintf(mg_out_msg, sizeof(mg_out_msg) - 1, "{\"X3\":\"X3\"}");
-        g_warning("TFlowMG: bad http request - %s", j_err.c_str());
-        res = write(pipe_fd_tflow2mg[1], &mg_in_msg, sizeof(mg_in_msg) - 1);
-        return 0;
+    // Big messages are streamed to Mongoose in parts
+    size_t ofs = 0;
+    do {
+        size_t part_len = std::min(msg_len - ofs, (size_t)TFLOW_MG_PART_SIZE);
+        int flags = (ofs + part_len < msg_len) ? mg_msg_hdr::MORE : reply_flags;
+
+        if (tflow2mg_backlog.empty() && 
+            pushMsgToMg(req_id, flags, msg.c_str() + ofs, part_len)) {
+            ofs += part_len;
+            continue;
+        }
+
+        tflow2mg_stats.backlog_bytes += part_len;
+        tflow2mg_stats.backlog_peak = std::max(tflow2mg_stats.backlog_peak, tflow2mg_stats.backlog_bytes);
+        tflow2mg_backlog.push_back({ .req_id = req_id, .flags = flags,
+            .msg = msg.substr(ofs, part_len) });
+        ofs += part_len;
+    } while (ofs < msg_len);
+
+    // Retry right away, otherwise Mongoose kicks us on free space
+    flushBacklog();
+
+    return 0;
+}
+
+bool TFlowMg::pushMsgToMg(const TFlowReqId &req_id, int flags, const char *msg, size_t len)
+{
+    struct iovec part = { .iov_base = (void*)msg, .iov_len = len };
+
+    return pushMsgToMg(req_id, flags, &part, 1);
+}
+
+bool TFlowMg::pushMsgToMg(const TFlowReqId &req_id, int flags, const struct iovec *parts, int parts_num)
+{
+    struct iovec iov[TFLOW_MG_MAX_MSG_PARTS + 1];
+    size_t len = 0;
+
+    assert(parts_num <= TFLOW_MG_MAX_MSG_PARTS);
+    for (int i = 0; i < parts_num; i++) {
+        iov[i + 1] = parts[i];
+        len += parts[i].iov_len;
     }
 
-    auto del_me = j_in_msg.dump();
+    struct mg_msg_hdr hdr = { .conn_id = req_id.conn_id, .seq = req_id.seq, .flags = flags, .len = len,
+        .ts_us = tflow_now_usec() };
+    iov[0] = { .iov_base = &hdr, .iov_len = sizeof(hdr) };
 
-    const json11::Json &http_req_control    = j_in_msg["control"];
-    const json11::Json &http_req_capture    = j_in_msg["capture"];
-    const json11::Json &http_req_mvision    = j_in_msg["mvision"];
-    const json11::Json &http_req_player_dir = j_in_msg["player_dir"];
-    const json11::Json &http_req_player     = j_in_msg["player"];
-    const json11::Json &http_req_streaming  = j_in_msg["streaming"];
-    const json11::Json &http_req_recording  = j_in_msg["recording"];
+    // Parts are TFLOW_MG_PART_SIZE at most, so they always fit eventually
+    assert(sizeof(hdr) + len <= ring_tflow2mg.maxMsgSize());
 
-    const std::string &module_name = j_in_msg.object_items().begin()->first;
+    bool was_empty;
+    if (!ring_tflow2mg.push(iov, parts_num + 1, &was_empty)) {
+        return false;
+    }
 
-    if (http_req_control.is_object()) {
-        onRequest(http_req_control);
-        return 0;
+    // Kick the Mongoose thread unless it is still busy with previous messages.
+    // A lost kick is repeated with the next message, and Mongoose also checks
+    // the ring on every poll.
+    if (was_empty || tflow2mg_kick) {
+        tflow2mg_kick = !mg_wakeup(&mgr, mg_data.lsn_id, NULL, 0);
     }
-    if (http_req_mvision.is_object()) {
-        
-        // Check TFlow Process module is online 
-        // Player is a part of tflow-process so far.
-        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(TFlowControl::SRV_NAME_PROCESS);
-        if (cli.sck_state_flag.v != Flag::SET) {
-            // CtrlServerProcess isn't connected
-            sendMsgToMg( json11::Json::object( {
-                { module_name.c_str(),
-                    json11::Json::object({ { "state", "off" } })
-                } }));
-            return 0;
-        }
+    tflow2mg_stats.sent++;
+    return true;
+}
 
-        if (http_req_mvision.object_items().empty()) {
-            // Empty request - the module will respond with controls
-            json11::Json j_dummy;
-            cli.sendMsgToCtrl("controls", j_dummy.object_items());
+void TFlowMg::flushBacklog()
+{
+    while (!tflow2mg_backlog.empty()) {
+        mg_backlog_msg &m = tflow2mg_backlog.front();
+        if (!pushMsgToMg(m.req_id, m.flags, m.msg.c_str(), m.msg.length())) {
+            ring_tflow2mg.waitSpace();
+            if (!pushMsgToMg(m.req_id, m.flags, m.msg.c_str(), m.msg.length())) return;
         }
-        else {
-            // Strip modules name. For ex.: 
-            // {"mvision" : { "config" : {  params } } } ==> { "config" : {  params } } 
-            // j_cmd = { "config" : {  params } } 
-            const json11::Json &j_cmd = http_req_mvision.object_items().begin()->second;
-            const std::string &cmd_name = http_req_mvision.object_items().begin()->first;
-
-            auto del_me = j_cmd.dump();
-
-            // Command parametr(s) are always object
-            if (!j_cmd.is_object()) {
-                g_critical("TFlowCtrlCli: Bad incoming message format");
-                return 0;   // Bad format
-            }
+        tflow2mg_stats.delayed++;
+        tflow2mg_stats.backlog_bytes -= m.msg.length();
+        tflow2mg_backlog.pop_front();
+    }
+}
 
-            cli.sendMsgToCtrl(cmd_name.c_str(), j_cmd.object_items());   
-        }
-    } 
+void TFlowMg::dropMsgToMg(size_t len, const char *reason)
+{
+    tflow2mg_stats.dropped++;
+
+    PRESC(0x3F) {
+        g_warning("TFlowMg: Message (%ld bytes) dropped - %s. "
+            "Sent %lu, delayed %lu, dropped %lu, backlog peak %ld bytes",
+            len, reason, tflow2mg_stats.sent, tflow2mg_stats.delayed,
+            tflow2mg_stats.dropped, tflow2mg_stats.backlog_peak);
+    }
+}
+
+int TFlowMg::onMsgFromMg()
+{
+    eventfd_t kicks;
+    const char *msg;
+    size_t len;
 
-    if (http_req_player_dir.is_object() ||
-        http_req_player.is_object()) {
-        
-        // Player is a part of tflow-process so far, thus check TFlow Process 
-        // module is online.
+    // Reset the doorbell before draining the ring
+    if (eventfd_read(evfd_mg2tflow, &kicks) && errno != EAGAIN) {
+        g_warning("TFlowMg: unexpected error (%d) - %s", errno, strerror(errno));
+        return -1;
+    }
 
-         // IN from UI:      {"player(_dir)" : { params } }
-         // OUT to Process:  {"cmd" : "player(_dir)", "dir" : "request", "params" : { params }} }
+    struct joy_frame joy;
+    uint64_t joy_rx_us = 0;
 
-        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(TFlowControl::SRV_NAME_PROCESS);
-        if (cli.sck_state_flag.v != Flag::SET) {
-            // CtrlServerProcess isn't connected
-            sendMsgToMg( json11::Json::object({
-                { module_name.c_str(),
-                    json11::Json::object({ { "state", "off" } } )
-                } }));
-            return 0;
+    while (ring_mg2tflow.peek(&msg, &len)) {
+        struct mg_msg_hdr hdr;
+        memcpy(&hdr, msg, sizeof(hdr));
+
+        if (hdr.flags & mg_msg_hdr::JOY) {
+            // Latest frame wins - forward only the last one of the batch
+            if (joy_rx_us) joy_merged++;
+            memcpy(&joy, msg + sizeof(hdr), sizeof(joy));
+            joy_rx_us = hdr.ts_us;
+            ring_mg2tflow.pop();
+            continue;
         }
-        const json11::Json &j_cmd = 
-            http_req_player.is_object()     ? http_req_player :
-            http_req_player_dir.is_object() ? http_req_player_dir: 
-            json11::Json();
 
-        // auto del_me = j_cmd.dump();
+        onMgRequest(TFlowReqId{ .conn_id = hdr.conn_id, .seq = hdr.seq },
+            std::string(msg + sizeof(hdr), hdr.len));
+        ring_mg2tflow.pop();
+
+        app->metrics.hops[TFlowMetrics::HOP_DISPATCH].add(tflow_now_usec() - hdr.ts_us);
+    }
+
+    if (joy_rx_us) {
+        onJoystick(joy, joy_rx_us);
+    }
+
+    // The kick may come from Mongoose freeing space in ring_tflow2mg
+    flushBacklog();
+
+    return 0;
+}
+
+// The request can't be passed on - the HTTP client gets an error right away
+// instead of waiting for the timeout
+int TFlowMg::sendErrToMg(int reply_flags, const char *err_msg, const TFlowReqId &req_id)
+{
+    struct iovec part = { .iov_base = (void*)err_msg, .iov_len = strlen(err_msg) };
+
+    return sendMsgToMg(&part, 1, req_id, reply_flags);
+}
+
+int TFlowMg::onMgRequest(const TFlowReqId &req_id, const std::string &req)
+{
+    // Parse input msg to Json. Pass Json to an approriated module
+    std::string j_err;
+    const json11::Json j_in_msg = json11::Json::parse(req, j_err);
+
+    if (!j_in_msg.is_object() || j_in_msg.object_items().empty()) {
+        g_warning("TFlowMG: bad http request - %s", j_err.c_str());
+        sendErrToMg(mg_msg_hdr::BAD_REQUEST, "bad request", req_id);
+        return 0;
+    }
 
-        const char *cmd_name = 
-            http_req_player.is_object() ? "player" :
-            http_req_player_dir.is_object() ? "player_dir" :
-            nullptr;
+    bool handled = false;           // A module or TFlowControl replies
+    int err_flags = mg_msg_hdr::NOT_FOUND;
+    const char *err_msg = "unknown module";
 
-        // Split command object into "name" and "params"
-        const json11::Json::object &cmd_params = j_cmd.object_items();
+    for (auto &it : j_in_msg.object_items()) {
+        const std::string &module_name = it.first;
+        const json11::Json &http_req = it.second;
 
-        cli.sendMsgToCtrl(cmd_name, cmd_params);
-    } 
+        if (!http_req.is_object()) {
+            err_flags = mg_msg_hdr::BAD_REQUEST;
+            err_msg = "bad request";
+            continue;
+        }
 
-    if (http_req_capture.is_object()) {
-        
-        // Capture request received. For ex.: { "capture" : { "config" : {  params } } }
-        // 
-        // In form UI: {"capture" : { "config" : {  params } } }
-        // Out to Capture: {"cmd" : "config", "dir" : "request", "params" : { params }} }							
+        if (module_name == "control") {
+            onRequest(http_req, req_id);
+            return 0;
+        }
 
-        // Get Capture related TFlowControl client by array index and check 
-        // TFlow Capture module is online.
+        // IN from WEB:   {"capture" : { "config" : {  params } } }
+        // OUT to module: {"cmd" : "config", "dir" : "request", "params" : { params }} }
+        // Modules sharing the same TFlow module distinguish commands by prefix
+        // IN from WEB:   {"recording" : { "config" : {  params } } }
+        // OUT to module: {"cmd" : "recording_config" , "dir": "request", "params" : { params }} }
+        // Player is a part of tflow-process so far
+        // IN from UI:    {"player(_dir)" : { params } }
+        // OUT to module: {"cmd" : "player(_dir)", "dir" : "request", "params" : { params }} }
+        const TFlowControl::route *route = TFlowControl::findRoute(module_name.c_str(), module_name.length());
+        if (route == nullptr) {
+            continue;
+        }
+        if (route->flags & TFlowControl::route::EVENTS) {
+            err_flags = mg_msg_hdr::BAD_REQUEST;
+            err_msg = "events only";
+            continue;
+        }
 
-        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(TFlowControl::SRV_NAME_CAPTURE);
-        if (cli.sck_state_flag.v != Flag::SET) {
-            // CtrlServerCapture isn't connected
-            sendMsgToMg( json11::Json::object({
+        // Check the TFlow module is online
+        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(route->srv);
+        if (!cli.isUp()) {
+            sendMsgToMg( json11::Json::object( {
                 { module_name.c_str(),
-                    json11::Json::object({ { "state", "off" } })
-                } }));
+                    json11::Json::object({ { "state", cli.isConnected() ? "stalled" : "off" } })
+                } }), req_id);
             return 0;
         }
 
-        if (http_req_capture.object_items().empty()) {
+        if (route->flags & TFlowControl::route::CMD_IS_NAME) {
+            cli.sendMsgToCtrl(route->ui_name, http_req.object_items(), req_id);
+            handled = true;
+            continue;
+        }
+
+        if (http_req.object_items().empty()) {
+            if (route->flags & TFlowControl::route::CONTROLS) {
+                // Empty request - the module will respond with controls
+                json11::Json j_dummy;
+                cli.sendMsgToCtrl("controls", j_dummy.object_items(), req_id);
+                handled = true;
+                continue;
+            }
             g_critical("TFlowCtrlCli: Bad incoming message format");
+            if (!handled) sendErrToMg(mg_msg_hdr::BAD_REQUEST, "empty request", req_id);
             return 0;
         }
 
         // Strip modules name - j_cmd = { "config" : {  params } } 
-        const json11::Json &j_cmd = http_req_capture.object_items().begin()->second;
-        const std::string &cmd_name = http_req_capture.object_items().begin()->first;
-
-        //auto del_me = j_cmd.dump();
+        const json11::Json &j_cmd = http_req.object_items().begin()->second;
+        const std::string &cmd_name = http_req.object_items().begin()->first;
 
         // Command parametr(s) are always object
         if (!j_cmd.is_object()) {
             g_critical("TFlowCtrlCli: Bad incoming message format");
+            if (!handled) sendErrToMg(mg_msg_hdr::BAD_REQUEST, "parameters must be an object", req_id);
             return 0;   // Bad format
         }
 
-        cli.sendMsgToCtrl(cmd_name.c_str(), j_cmd.object_items());   
+        std::string cmd(route->cmd_prefix, route->cmd_prefix_len);
+        sendCtrl(route->srv, cmd.append(cmd_name), j_cmd.object_items(), req_id);
+        handled = true;
+    }
+
+    if (!handled) {
+        g_warning("TFlowMG: request not passed on - %s", err_msg);
+        sendErrToMg(err_flags, err_msg, req_id);
+        return 0;
     }
 
-    if (http_req_streaming.is_object() || 
-        http_req_recording.is_object()) {
-        
-        // Streaming and Recording occupy the same TFlow module - VStream.
-        // So, lets distinguish commands by adding the suffix to a command.
+    // The HTTP connection stays parked on Mongoose side until the module
+    // responds (see TFlowCtrlCli::onCtrlMsgParse) or the request times out.
 
-        // IN from WEB : {"recording" : { "config" : {  params } } }
-        // Out to VStream {"cmd" : "recording_config" , "dir": "request", "params" : { params }} }							
+    return 0;
+}
 
-        // IN from WEB : {"streaming" : { "config" : {  params } } }
-        // Out to VStream {"cmd" : "streaming_config" , "dir": "request", "params" : { params }} }							
+void TFlowMg::onJoystick(const struct joy_frame &joy, uint64_t rx_us)
+{
+    static const TFlowControl::route *route = TFlowControl::findRoute("joystick", 8);
+    if (route == nullptr) return;
 
-        // Get VStream related TFlowControl client by array index and check 
-        // TFlow Capture module is online.
+    TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(route->srv);
+    if (!cli.isUp()) return;
 
-        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(TFlowControl::SRV_NAME_VSTREAM);
-        if (cli.sck_state_flag.v != Flag::SET) {
-            // CtrlServerVStream isn't connected
-            sendMsgToMg( json11::Json::object ({
-                { module_name.c_str(),
-                    json11::Json::object({ { "state", "off" } })
-                } }));
-            return 0;
-        }
+    char j_params[128];
+    snprintf(j_params, sizeof(j_params), 
+        "{\"seq\":%u,\"axis\":[%d,%d,%d,%d],\"buttons\":%u}",
+        joy.seq, joy.axis[0], joy.axis[1], joy.axis[2], joy.axis[3], joy.buttons);
 
-        const json11::Json &j_http_req = 
-            http_req_streaming.is_object() ? http_req_streaming :
-            http_req_recording.is_object() ? http_req_recording : 
-            json11::Json();
+    if (0 == cli.sendEventToCtrl(route->ui_name, j_params)) {
+        app->metrics.hops[TFlowMetrics::HOP_JOY].add(tflow_now_usec() - rx_us);
+    }
+}
+
+// The browser fires an update per slider tick. Settings updates are 
+// throttled per module, command and parameter names: a lone update goes
+// right away, the following ones within ui_coalesce_msec are merged and 
+// only the latest value is sent at the window end.
+void TFlowMg::sendCtrl(int srv, const std::string &cmd, const json11::Json::object &params,
+    const TFlowReqId &req_id)
+{
+    TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(srv);
+    uint64_t window_us = (uint64_t)app->cfg.ui_coalesce_msec * 1000;
 
-        std::string cmd_suffix = 
-            http_req_streaming.is_object() ? "streaming_" :
-            http_req_recording.is_object() ? "recording_" :
-            std::string();
+    if (window_us == 0 || params.empty() || !TFlowCtrlCli::isCoalescedCmd(cmd.c_str())) {
+        cli.sendMsgToCtrl(cmd.c_str(), params, req_id);
+        return;
+    }
 
+    std::string key = std::to_string(srv).append(1, '\0').append(cmd);
+    for (auto &p : params) key.append(1, '\0').append(p.first);
 
-        if (j_http_req.is_object()) {
-            if (j_http_req.object_items().empty()) {
-                g_critical("TFlowCtrlCli: Bad incoming message format");
-                return 0;
-            }
+    uint64_t now_us = tflow_now_usec();
+    coalesce_slot &slot = coalesce_slots[key];
+
+    if (!slot.pending && now_us - slot.last_sent_us >= window_us) {
+        slot.last_sent_us = now_us;
+        cli.sendMsgToCtrl(cmd.c_str(), params, req_id);
+        return;
+    }
+
+    if (slot.pending) {
+        // Newer value wins - don't keep the older request waiting
+        cli.rejectReq(slot.req_id, cmd.c_str(), ECANCELED, "superseded");
+        coalesced++;
+    }
+    else {
+        slot.pending = true;
+        slot.srv = srv;
+        slot.cmd = cmd;
+    }
+    slot.params = params;
+    slot.req_id = req_id;
+
+    armCoalesceTimer(slot.last_sent_us + window_us - now_us);
+}
+
+static gboolean tflow_mg_coalesce_timer(gpointer user_data)
+{
+    TFlowMg* mg = (TFlowMg*)user_data;
+
+    mg->onCoalesceTimer();
+    return G_SOURCE_REMOVE;
+}
+
+void TFlowMg::armCoalesceTimer(uint64_t delay_us)
+{
+    if (coalesce_src) return;       // Fires not later than a window from now
+
+    coalesce_src = g_timeout_source_new((delay_us + 999) / 1000);
+    g_source_set_callback(coalesce_src, (GSourceFunc)tflow_mg_coalesce_timer, this, nullptr);
+    g_source_attach(coalesce_src, app->context);
+}
+
+void TFlowMg::onCoalesceTimer()
+{
+    g_source_unref(coalesce_src);
+    coalesce_src = nullptr;
+
+    uint64_t window_us = (uint64_t)app->cfg.ui_coalesce_msec * 1000;
+    uint64_t now_us = tflow_now_usec();
+    uint64_t next_us = UINT64_MAX;
+
+    for (auto it = coalesce_slots.begin(); it != coalesce_slots.end(); ) {
+        coalesce_slot &slot = it->second;
+        uint64_t due_us = slot.last_sent_us + window_us;
+
+        if (!slot.pending) {
+            // Nothing is held back - forget quiet keys
+            it = (now_us >= due_us) ? coalesce_slots.erase(it) : std::next(it);
+            continue;
+        }
+        if (now_us < due_us) {
+            next_us = std::min(next_us, due_us - now_us);
+            it++;
+            continue;
         }
 
-        // Command parametr(s) are always object
-        const json11::Json &j_cmd = j_http_req.object_items().begin()->second;
-        if (!j_cmd.is_object()) {
-            g_critical("TFlowCtrlCli: Bad incoming message format");
-            return 0;   // Bad format
+        TFlowCtrlCli &cli = app->tflow_ctrl_clis.at(slot.srv);
+        if (cli.isUp()) {
+            cli.sendMsgToCtrl(slot.cmd.c_str(), slot.params, slot.req_id);
+        }
+        else {
+            // The module went away while the update was held back
+            cli.rejectReq(slot.req_id, slot.cmd.c_str(), ENOTCONN, "module is off");
         }
+        slot.last_sent_us = now_us;
+        slot.pending = false;
+        slot.params.clear();
+        next_us = std::min(next_us, window_us);
+        it++;
+    }
+
+    if (next_us != UINT64_MAX) {
+        armCoalesceTimer(next_us);
+    }
+}
 
-        auto del_me = j_cmd.dump();
+static gboolean tflow_mg_cert_dispatch(gint fd, GIOCondition condition, gpointer user_data)
+{
+    TFlowMg* mg = (TFlowMg*)user_data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
 
-        // Split command object into "name" and "params"
-        const json11::Json::object &cmd_params = j_cmd.object_items();
-        cli.sendMsgToCtrl(cmd_suffix.append(j_http_req.object_items().begin()->first.c_str()).c_str(), cmd_params);   
+    // Several files may be changed at once - reload only once
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        changed = true;
+    }
+    if (changed) {
+        mg->reloadTls();
     }
+    return G_SOURCE_CONTINUE;
+}
+
+// Watch the directory rather than the file - credentials are usually 
+// replaced by rename()
+bool TFlowMg::watchDir(const char *file)
+{
+    gchar *dir = g_path_get_dirname(file);
+    int wd = inotify_add_watch(cert_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+    g_free(dir);
 
-    // Does Mongoose provide multiple parrallel requests at a time?
-    // If so, as we don't support real multi-user environment yet, lets block
-    // the further MG message processing until response received or timeout
-    // triggered.
-    // TODO: ^^^    
+    return wd != -1;
+}
 
-    return 0;
+// Any thread. The credentials are reloaded by Mongoose thread.
+void TFlowMg::reloadTls()
+{
+    mg_wakeup(&mgr, mg_data.lsn_id, TFLOW_MG_WAKEUP_TLS, strlen(TFLOW_MG_WAKEUP_TLS));
 }
 
 gboolean tflow_mg_fifo_dispatch(GSource* g_source, GSourceFunc callback, gpointer user_data)
@@ -538,7 +971,7 @@ gboolean tflow_mg_fifo_dispatch(GSource* g_source, GSourceFunc callback, gpointe
     rc = mg->onMsgFromMg();
 
     if (rc) {
-        // Critical error on PIPE. 
+        // Critical error on the doorbell. 
         return G_SOURCE_REMOVE;
     }
     else {
@@ -552,10 +985,6 @@ void* TFlowMg::_thread(void* ctx)
     TFlowMg* m = (TFlowMg*)ctx;
 
     /* Mongoose main thread */
-    mg_mgr_init(&m->mgr);           // Initialise event manager
-    mg_log_set(MG_LL_DEBUG);        // Set debug log level
-    mg_http_listen(&m->mgr, "http://0.0.0.0:8000", m->_on_msg, (void*)&m->mg_data);
-    mg_wakeup_init(&m->mgr);        // Initialise wakeup socket pair
     for (;;) {                      // Event loop
         mg_mgr_poll(&m->mgr, 1000);
     }
@@ -564,37 +993,72 @@ void* TFlowMg::_thread(void* ctx)
     return nullptr;
 }
 
-TFlowMg::TFlowMg(TFlowControl* _app)
+TFlowMg::TFlowMg(TFlowControl* _app) :
+    ring_mg2tflow(_app->cfg.ring_mg2tflow_size),
+    ring_tflow2mg(_app->cfg.ring_tflow2mg_size)
 {
-    int rc;
     app = _app;
 
-    pipe_tag = NULL;
-    pipe_src = NULL;
-    CLEAR(pipe_gsfuncs);
+    ring_tag = NULL;
+    ring_src = NULL;
+    CLEAR(ring_gsfuncs);
 
     last_idle_check = 0;
 
-    rc = pipe2(pipe_fd_mg2tflow, O_NONBLOCK);
-    if (rc) {
-        g_warning("TFlow error in Mongoose initiation (mg2tflow)");
+    evfd_mg2tflow = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (evfd_mg2tflow == -1) {
+        g_warning("TFlow error in Mongoose initiation (eventfd)");
         return;
     }
-    mg_data.wr_fd = pipe_fd_mg2tflow[1];
-
-    rc = pipe2(pipe_fd_tflow2mg, O_NONBLOCK);
-    if (rc) {
-        g_warning("TFlow error in Mongoose initiation (tflow2mg)");
-        return;
+    mg_data.wr_evfd = evfd_mg2tflow;
+    mg_data.wr_ring = &ring_mg2tflow;
+    mg_data.rd_ring = &ring_tflow2mg;
+    mg_data.metrics = &app->metrics;
+    mg_data.cfg = &app->cfg;
+
+    /* Assign g_source on the doorbell */
+    ring_gsfuncs.dispatch = tflow_mg_fifo_dispatch;
+    ring_src = (GSourceMg*)g_source_new(&ring_gsfuncs, sizeof(GSourceMg));
+    ring_tag = g_source_add_unix_fd((GSource*)ring_src, evfd_mg2tflow, (GIOCondition)(G_IO_IN /* | G_IO_ERR  | G_IO_HUP */));
+    ring_src->mg = this;
+    g_source_attach((GSource*)ring_src, app->context);
+
+    /* Reload TLS credentials once they are changed */
+    cert_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cert_fd != -1 && 
+        watchDir(app->cfg.tls_cert.c_str()) && watchDir(app->cfg.tls_key.c_str())) {
+        cert_src = g_unix_fd_source_new(cert_fd, G_IO_IN);
+        g_source_set_callback(cert_src, (GSourceFunc)tflow_mg_cert_dispatch, this, nullptr);
+        g_source_attach(cert_src, app->context);
+    }
+    else {
+        g_warning("TFlowMg: Can't watch TLS credentials (%d) - %s", errno, strerror(errno));
     }
-    mg_data.rd_fd = pipe_fd_tflow2mg[0];
+    _tls_load(&mg_data);
+
+    /* Initialize Mongoose before the thread start, so TFlow side can
+     * wake it up right away */
+    mg_mgr_init(&mgr);              // Initialise event manager
+    mg_log_set(app->cfg.mg_log_level);
+    for (const std::string &url : app->cfg.listen) {
+        struct mg_connection *lsn = mg_http_listen(&mgr, url.c_str(), _on_msg, (void*)&mg_data);
+        if (lsn == nullptr) {
+            g_warning("TFlowMg: Can't listen on %s", url.c_str());
+            continue;
+        }
+        if (mg_data.lsn_num == ARRAYSIZE(mg_data.lsn)) {
+            g_warning("TFlowMg: Too many listeners - %s is not served", url.c_str());
+            lsn->is_closing = 1;
+            continue;
+        }
+        mg_data.lsn[mg_data.lsn_num].loc = lsn->loc;
+        mg_data.lsn[mg_data.lsn_num].tls = lsn->is_tls;
+        mg_data.lsn_num++;
 
-    /* Assign g_source on the socket */
-    pipe_gsfuncs.dispatch = tflow_mg_fifo_dispatch;
-    pipe_src = (GSourceMg*)g_source_new(&pipe_gsfuncs, sizeof(GSourceMg));
-    pipe_tag = g_source_add_unix_fd((GSource*)pipe_src, pipe_fd_mg2tflow[0], (GIOCondition)(G_IO_IN /* | G_IO_ERR  | G_IO_HUP */));
-    pipe_src->mg = this;
-    g_source_attach((GSource*)pipe_src, app->context);
+        // Any listener is good to be woken up
+        if (mg_data.lsn_id == 0) mg_data.lsn_id = lsn->id;
+    }
+    mg_wakeup_init(&mgr);           // Initialise wakeup socket pair
 
     /* Create mongoose thread */
     int ret;
@@ -609,21 +1073,35 @@ TFlowMg::TFlowMg(TFlowControl* _app)
 
 TFlowMg::~TFlowMg()
 {
-    if (pipe_fd_mg2tflow[0] != -1) {
-        close(pipe_fd_mg2tflow[0]);
+    if (ring_src) {
+        if (ring_tag) {
+            g_source_remove_unix_fd((GSource*)ring_src, ring_tag);
+            ring_tag = nullptr;
+        }
+        g_source_destroy((GSource*)ring_src);
+        g_source_unref((GSource*)ring_src);
+        ring_src = nullptr;
+    }
+
+    if (evfd_mg2tflow != -1) {
+        close(evfd_mg2tflow);
+        evfd_mg2tflow = -1;
     }
-    if (pipe_fd_mg2tflow[1] != -1) {
-        close(pipe_fd_mg2tflow[1]);
+
+    if (coalesce_src) {
+        g_source_destroy(coalesce_src);
+        g_source_unref(coalesce_src);
+        coalesce_src = nullptr;
     }
 
-    if (pipe_src) {
-        if (pipe_tag) {
-            g_source_remove_unix_fd((GSource*)pipe_src, pipe_tag);
-            pipe_tag = nullptr;
-        }
-        g_source_destroy((GSource*)pipe_src);
-        g_source_unref((GSource*)pipe_src);
-        pipe_src = nullptr;
+    if (cert_src) {
+        g_source_destroy(cert_src);
+        g_source_unref(cert_src);
+        cert_src = nullptr;
+    }
+    if (cert_fd != -1) {
+        close(cert_fd);
+        cert_fd = -1;
     }
 
     // Close Mongoose thread?
@@ -1,6 +1,10 @@
 #pragma once 
 
+#include <deque>
+#include <unordered_map>
+
 #include "mongoose.h"
+#include "tflow-ring.hpp"
 
 class TFlowControl;
 class TFlowMg {
@@ -14,9 +18,14 @@ public:
     // int Connect();
 
     //void Disconnect();
-    int onRequest(const json11::Json &j_msg);
+    int onRequest(const json11::Json &j_msg, const TFlowReqId &req_id);
     int onMsgFromMg();
-    int sendMsgToMg(const json11::Json::object &msg);
+    void onCoalesceTimer();
+    int sendMsgToMg(const json11::Json::object &msg, const TFlowReqId &req_id);
+    int sendMsgToMg(const struct iovec *parts, int parts_num, const TFlowReqId &req_id,
+        int reply_flags = 0);
+    int sendErrToMg(int reply_flags, const char *err_msg, const TFlowReqId &req_id);
+    void reloadTls();
 
     //int sendSignature();
 
@@ -29,9 +38,37 @@ public:
         TFlowMg* mg;
     } GSourceMg;
 
-    GSourceMg*   pipe_src;
-    gpointer     pipe_tag;
-    GSourceFuncs pipe_gsfuncs;
+    GSourceMg*   ring_src;
+    gpointer     ring_tag;
+    GSourceFuncs ring_gsfuncs;
+
+    // Header preceding every message in both rings
+    struct mg_msg_hdr {
+        static constexpr int MORE = 1;  // Message continues in the next part
+        static constexpr int JOY  = 2;  // Binary joystick frame, see joy_frame
+        static constexpr int BAD_REQUEST = 4;   // Reply 400, the message is a text
+        static constexpr int NOT_FOUND   = 8;   // Reply 404, the message is a text
+
+        unsigned long conn_id;  // Mongoose connection the message belongs to
+        int seq;                // Request number on the connection
+        int flags;
+        size_t len;             // Payload length excluding the header
+        uint64_t ts_us;         // tflow_now_usec() of the push
+    };
+
+    // Binary WebSocket frame on /websocket - joystick/gimbal control. 
+    // Little endian, no response. Only the latest frame matters - older 
+    // frames not forwarded yet are dropped.
+    struct joy_frame {
+        static constexpr uint8_t MAGIC = 'J';
+
+        uint8_t  magic;         // MAGIC
+        uint8_t  flags;         // Reserved, 0
+        uint16_t seq;           // Wraps. Lets the module spot lost frames.
+        int16_t  axis[4];       // -32767..32767, for ex. yaw, pitch, roll, zoom
+        uint32_t buttons;       // Bit per button
+    };
+    static_assert(sizeof(struct joy_frame) == 16);
 
 private:
     
@@ -39,14 +76,78 @@ private:
     // Pointer stored in mg_connection.fn_data
     struct mg_data {
         char mark[4];
-        int wr_fd;         
-        int rd_fd;
+        int wr_evfd;                // Doorbell of the TFlow side
+        TFlowRing *wr_ring;         // Requests to TFlow
+        TFlowRing *rd_ring;         // Responses and pushes from TFlow
+        unsigned long lsn_id;       // Listener connection - wakeup target
+        struct {
+            struct mg_addr loc;     // Copied to accepted connections
+            bool tls;
+        } lsn[4];                   // Listeners
+        int lsn_num;
+        int req_seq;                // Last assigned /api request number
+        unsigned long ws_dropped;   // Pushes not sent to slow WebSocket clients
+        unsigned long joy_dropped;  // Joystick frames not passed to TFlow
+        struct mg_iobuf ws_msg;     // Push being collected from parts
+        TFlowMetrics *metrics;
+        const TFlowSettings *cfg;
+        struct mg_str tls_cert;     // DER, shared by all connections
+        struct mg_str tls_key;      // DER
         // Connections specific data?
         // ..
-    } mg_data = {.mark = "MNG", .wr_fd = -1};
-
-    int pipe_fd_mg2tflow[2];    // Pipe TFlow <-- Mongoose 
-    int pipe_fd_tflow2mg[2];    // Pipe TFlow --> Mongoose
+    } mg_data = {.mark = "MNG", .wr_evfd = -1};
+
+    // Per connection state stored in mg_connection.data
+    struct mg_conn_state {
+        char mark;              // 'W' - WebSocket client, 'A' - /api request pending,
+                                // 'S' - /api response is being streamed
+        int api_seq;            // Pending request number
+        uint64_t api_start_us;  // tflow_now_usec() of the request
+        uint64_t api_deadline;  // mg_millis() to give up waiting for TFlow response
+    };
+    static_assert(sizeof(struct mg_conn_state) <= MG_DATA_SIZE);
+
+    TFlowRing ring_mg2tflow;    // TFlow <-- Mongoose 
+    TFlowRing ring_tflow2mg;    // TFlow --> Mongoose
+    int evfd_mg2tflow = -1;     // Doorbell for ring_mg2tflow. TFlow --> Mongoose
+                                // direction is kicked by mg_wakeup()
+    bool tflow2mg_kick = false; // mg_wakeup() failed - ring again on next push
+
+    int cert_fd = -1;           // inotify on TLS credentials
+    GSource *cert_src = nullptr;
+
+    // Messages waiting for room in ring_tflow2mg, oldest first
+    struct mg_backlog_msg {
+        TFlowReqId req_id;
+        int flags;
+        std::string msg;
+    };
+    std::deque<mg_backlog_msg> tflow2mg_backlog;
+
+    struct {
+        unsigned long sent;         // Messages passed to Mongoose
+        unsigned long delayed;      // ... via the backlog
+        unsigned long dropped;      // Messages lost
+        size_t backlog_bytes;       // Current backlog size
+        size_t backlog_peak;
+    } tflow2mg_stats = {};
+
+    // UI setting updates held back by coalescing, per module, command and
+    // parameter names. Only the latest value is forwarded.
+    struct coalesce_slot {
+        uint64_t last_sent_us;      // tflow_now_usec() the key was forwarded
+        bool pending;               // Value below waits for the window end
+        int srv;
+        std::string cmd;
+        json11::Json::object params;
+        TFlowReqId req_id;
+    };
+    std::unordered_map<std::string, coalesce_slot> coalesce_slots;
+    GSource *coalesce_src = nullptr;
+    unsigned long coalesced = 0;    // Updates never forwarded
+
+    unsigned long joy_merged = 0;   // Joystick frames replaced by newer ones
+    void onJoystick(const struct joy_frame &joy, uint64_t rx_us);
 
     pthread_t           th;
     pthread_cond_t      th_cond;
@@ -56,16 +157,28 @@ private:
 
     clock_t last_idle_check;
 
-    int msg_seq_num = 0;
-    char mg_in_msg[1024 * 1024];   // Messages from Mongoose to CtrlCli 
-    char mg_out_msg[1024 * 1024];  // Messages from CtrlCli to Mongoose
-
     clock_t last_send_ts;
 
+    int onMgRequest(const TFlowReqId &req_id, const std::string &req);
+    void sendCtrl(int srv, const std::string &cmd, const json11::Json::object &params,
+        const TFlowReqId &req_id);
+    void armCoalesceTimer(uint64_t delay_us);
+    bool pushMsgToMg(const TFlowReqId &req_id, int flags, const char *msg, size_t len);
+    bool pushMsgToMg(const TFlowReqId &req_id, int flags, const struct iovec *parts, int parts_num);
+    void flushBacklog();
+    bool watchDir(const char *file);
+    void dropMsgToMg(size_t len, const char *reason);
+
     static void* _thread(void* ctx);
 
     static void _on_msg(struct mg_connection* c, int ev, void* ev_data);
-    static void _wait_and_reply_tflow_response(struct mg_connection* c, struct mg_data* my_data);
+    static void _api_request(struct mg_connection* c, struct mg_data* my_data, struct mg_str body, uint64_t rx_us);
+    static bool _tls_load(struct mg_data* my_data);
+    static void _joy_frame(struct mg_connection* c, struct mg_data* my_data, struct mg_str data);
+    static void _metrics_request(struct mg_connection* c, struct mg_data* my_data, struct mg_http_message* hm);
+    static void _on_tflow_msg(struct mg_connection* c, struct mg_data* my_data);
+    static void _ws_broadcast(struct mg_mgr* mgr, struct mg_data* my_data, struct mg_str msg);
+    static void _reply_tflow_response(struct mg_mgr* mgr, struct mg_data* my_data, const struct mg_msg_hdr &hdr, struct mg_str msg);
 
 };
 
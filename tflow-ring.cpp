@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tflow-ring.hpp"
+
+TFlowRing::TFlowRing(size_t _size)
+{
+    size = (_size + 7) & ~(size_t)7;
+    buf = (char*)malloc(size);
+    head = 0;
+    tail = 0;
+    space_waiter = false;
+}
+
+TFlowRing::~TFlowRing()
+{
+    free(buf);
+}
+
+bool TFlowRing::push(const struct iovec *iov, int iovcnt, bool *was_empty)
+{
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+
+    size_t rec_size = recSize(len);
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t pos = t % size;
+    size_t to_end = size - pos;
+
+    // Records are never split. Skip the ring's tail if the record doesn't fit.
+    size_t need = (rec_size > to_end) ? to_end + rec_size : rec_size;
+    if (buf == nullptr || size - (t - h) < need) {
+        return false;
+    }
+
+    if (rec_size > to_end) {
+        *(uint64_t*)(buf + pos) = REC_WRAP;
+        pos = 0;
+    }
+
+    *(uint64_t*)(buf + pos) = len;
+    char *dst = buf + pos + sizeof(uint64_t);
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+
+    // Publish the record, then check whether the consumer has already 
+    // drained everything before it. Both sides use sequentially consistent
+    // accesses, so at least one of them sees the other's update.
+    tail.store(t + need);
+    if (was_empty) *was_empty = (head.load() == t);
+
+    return true;
+}
+
+bool TFlowRing::peek(const char **msg, size_t *len)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+
+    for (;;) {
+        if (h == tail.load()) return false;
+
+        size_t pos = h % size;
+        uint64_t rec_len = *(uint64_t*)(buf + pos);
+        if (rec_len == REC_WRAP) {
+            h += size - pos;
+            head.store(h);
+            continue;
+        }
+
+        *msg = buf + pos + sizeof(uint64_t);
+        *len = rec_len;
+        return true;
+    }
+}
+
+void TFlowRing::pop()
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    uint64_t rec_len = *(uint64_t*)(buf + h % size);
+
+    head.store(h + recSize(rec_len));
+}
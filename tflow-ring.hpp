@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Bounded single producer / single consumer ring of variable length 
+ * messages. Messages are stored contiguously, so the consumer accesses
+ * them in place.
+ */
+class TFlowRing {
+public:
+    TFlowRing(size_t size);
+    ~TFlowRing();
+
+    // Producer side. Message is gathered from iov. 
+    // was_empty is set if the consumer may be idle and needs a kick.
+    bool push(const struct iovec *iov, int iovcnt, bool *was_empty);
+
+    // Producer side. Longer messages never fit into the ring. Messages up to
+    // that size always fit into an empty ring.
+    size_t maxMsgSize() const { return size / 2 - sizeof(uint64_t); }
+
+    // Producer side. Ask the consumer for a kick once it frees some space.
+    // Retry the push afterwards - the space may be freed in between.
+    void waitSpace() { space_waiter.store(true); }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool peek(const char **msg, size_t *len);
+    void pop();
+
+    // Consumer side. Returns true once if the producer waits for space.
+    bool takeSpaceWaiter() { return space_waiter.load() && space_waiter.exchange(false); }
+
+private:
+    static constexpr uint64_t REC_WRAP = UINT64_MAX; // Continue from the beginning
+
+    static size_t recSize(size_t len) {
+        return (sizeof(uint64_t) + len + 7) & ~(size_t)7;
+    }
+
+    char   *buf;
+    size_t  size;
+
+    std::atomic<size_t> head;   // Consumer position
+    std::atomic<size_t> tail;   // Producer position
+
+    std::atomic<bool> space_waiter;
+};
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib-unix.h>
+#include <json11.hpp>
+
+#include "tflow-settings.hpp"
+
+#define TFLOW_SETTINGS_MIN_BUF_SIZE  (4 * 1024)
+
+static bool get_int(const json11::Json &j, const char *key, int min, int *val)
+{
+    const json11::Json &v = j[key];
+
+    if (v.is_null()) return true;
+
+    if (!v.is_number() || v.number_value() < min || v.number_value() > INT32_MAX) {
+        g_warning("TFlowSettings: bad \"%s\" - keep %d", key, *val);
+        return false;
+    }
+    *val = v.int_value();
+    return true;
+}
+
+static bool get_size(const json11::Json &j, const char *key, size_t min, size_t *val)
+{
+    const json11::Json &v = j[key];
+
+    if (v.is_null()) return true;
+
+    if (!v.is_number() || v.number_value() < min || v.number_value() > (double)(1UL << 30)) {
+        g_warning("TFlowSettings: bad \"%s\" - keep %zu", key, *val);
+        return false;
+    }
+    *val = (size_t)v.number_value();
+    return true;
+}
+
+static bool get_bool(const json11::Json &j, const char *key, bool *val)
+{
+    const json11::Json &v = j[key];
+
+    if (v.is_null()) return true;
+
+    if (!v.is_bool()) {
+        g_warning("TFlowSettings: bad \"%s\" - keep %s", key, *val ? "true" : "false");
+        return false;
+    }
+    *val = v.bool_value();
+    return true;
+}
+
+static bool get_str(const json11::Json &j, const char *key, std::string *val)
+{
+    const json11::Json &v = j[key];
+
+    if (v.is_null()) return true;
+
+    if (!v.is_string() || v.string_value().empty()) {
+        g_warning("TFlowSettings: bad \"%s\" - keep %s", key, val->c_str());
+        return false;
+    }
+    *val = v.string_value();
+    return true;
+}
+
+bool TFlowSettings::load(const char *path)
+{
+    gchar *text = nullptr;
+    gsize len = 0;
+    GError *err = nullptr;
+
+    if (!g_file_get_contents(path, &text, &len, &err)) {
+        bool missing = g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+        if (missing) {
+            g_info("TFlowSettings: %s not found - defaults are used", path);
+        }
+        else {
+            g_warning("TFlowSettings: Can't read %s - %s", path, err->message);
+        }
+        g_error_free(err);
+        return missing;
+    }
+
+    std::string parse_err;
+    json11::Json j = json11::Json::parse(std::string(text, len), parse_err);
+    g_free(text);
+
+    if (!j.is_object()) {
+        g_warning("TFlowSettings: %s is not a JSON object - %s", path, parse_err.c_str());
+        return false;
+    }
+
+    bool ok = true;
+
+    const json11::Json &j_listen = j["listen"];
+    if (j_listen.is_array() && !j_listen.array_items().empty()) {
+        listen.clear();
+        for (auto &j_url : j_listen.array_items()) {
+            if (j_url.is_string()) listen.push_back(j_url.string_value());
+        }
+    }
+    else if (!j_listen.is_null()) {
+        g_warning("TFlowSettings: bad \"listen\" - keep defaults");
+        ok = false;
+    }
+
+    ok &= get_str(j, "web_root", &web_root);
+    ok &= get_str(j, "tls_cert", &tls_cert);
+    ok &= get_str(j, "tls_key", &tls_key);
+    ok &= get_bool(j, "tls_ktls", &tls_ktls);
+    ok &= get_int(j, "mg_log_level", 0, &mg_log_level);
+
+    ok &= get_int(j, "api_timeout_msec", 10, &api_timeout_msec);
+    ok &= get_int(j, "reconnect_min_msec", 1, &reconnect_min_msec);
+    ok &= get_int(j, "reconnect_max_msec", 1, &reconnect_max_msec);
+    if (reconnect_max_msec < reconnect_min_msec) {
+        g_warning("TFlowSettings: \"reconnect_max_msec\" < \"reconnect_min_msec\" - use %d", reconnect_min_msec);
+        reconnect_max_msec = reconnect_min_msec;
+        ok = false;
+    }
+    ok &= get_int(j, "ping_interval_msec", 0, &ping_interval_msec);
+    ok &= get_int(j, "ping_max_missed", 1, &ping_max_missed);
+    ok &= get_int(j, "ui_coalesce_msec", 0, &ui_coalesce_msec);
+
+    ok &= get_size(j, "ring_mg2tflow_size", TFLOW_SETTINGS_MIN_RING_SIZE, &ring_mg2tflow_size);
+    ok &= get_size(j, "ring_tflow2mg_size", TFLOW_SETTINGS_MIN_RING_SIZE, &ring_tflow2mg_size);
+    ok &= get_size(j, "backlog_max_bytes", TFLOW_MG_PART_SIZE, &backlog_max_bytes);
+    ok &= get_size(j, "ws_max_send", TFLOW_SETTINGS_MIN_BUF_SIZE, &ws_max_send);
+    ok &= get_size(j, "cli_in_msg_size", TFLOW_SETTINGS_MIN_BUF_SIZE, &cli_in_msg_size);
+    ok &= get_size(j, "cli_out_queue_bytes", TFLOW_SETTINGS_MIN_BUF_SIZE, &cli_out_queue_bytes);
+    ok &= get_int(j, "cli_dispatch_budget", 1, &cli_dispatch_budget);
+
+    // Receive buffer grows in steps of its initial size - keep it a power of two
+    cli_in_msg_size = 1UL << (64 - __builtin_clzl(cli_in_msg_size - 1));
+
+    for (auto &item : j.object_items()) {
+        static const char *known[] = {
+            "listen", "web_root", "tls_cert", "tls_key", "tls_ktls", "mg_log_level",
+            "api_timeout_msec", "reconnect_min_msec", "reconnect_max_msec",
+            "ping_interval_msec", "ping_max_missed", "ui_coalesce_msec",
+            "ring_mg2tflow_size", "ring_tflow2mg_size", "backlog_max_bytes",
+            "ws_max_send", "cli_in_msg_size", "cli_out_queue_bytes",
+            "cli_dispatch_budget", nullptr };
+        const char **k = known;
+        while (*k && item.first != *k) k++;
+        if (*k == nullptr) {
+            g_warning("TFlowSettings: unknown \"%s\" ignored", item.first.c_str());
+        }
+    }
+
+    g_info("TFlowSettings: loaded from %s", path);
+    return ok;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+#define TFLOW_MG_PART_SIZE          (256 * 1024)         // Bigger messages are streamed
+
+// Smallest ring that takes a TFLOW_MG_PART_SIZE part at any offset - a record
+// that doesn't fit before the ring's end needs up to twice its size.
+#define TFLOW_SETTINGS_MIN_RING_SIZE (1024 * 1024)
+
+/*
+ * Runtime settings loaded once at startup from a JSON file. Missing file or
+ * missing keys leave the defaults below - they are the values used by
+ * deployments without the file.
+ * Read-only after load(), so Mongoose thread may use it as well.
+ */
+struct TFlowSettings {
+    // Web server. TLS is on for "https://" listeners only.
+    std::vector<std::string> listen = {
+        "https://0.0.0.0:8000",             // Web UI
+        "http://127.0.0.1:8080",            // Local tooling and health checks
+        // "unix:///run/tflow-control.sock",   // Local tooling, no TCP at all
+    };
+    std::string web_root = "/home/root/web_root";
+    std::string tls_cert = "/home/root/cert/server.crt";    // PEM or DER
+    std::string tls_key  = "/home/root/cert/server.key";    // PEM or DER
+    bool tls_ktls = false;                  // Kernel encrypts HTTPS responses, if it has "tls" module
+    int mg_log_level = 3;                   // MG_LL_DEBUG
+
+    // Timing
+    int api_timeout_msec = 3000;            // TFlow module must respond to /api within
+    int reconnect_min_msec = 50;            // TFlow module reconnect backoff -
+    int reconnect_max_msec = 1000;          //   doubles from min up to max
+    int ping_interval_msec = 1000;          // TFlow module heartbeat. 0 - off
+    int ping_max_missed = 3;                // Module is stalled after that many pings left unanswered
+    int ui_coalesce_msec = 20;              // UI setting updates are forwarded at most once per. 0 - off
+
+    // Memory
+    size_t ring_mg2tflow_size = 1024 * 1024;
+    size_t ring_tflow2mg_size = 4 * 1024 * 1024;    // player_dir may be big
+    size_t backlog_max_bytes = 8 * 1024 * 1024;     // Waiting for ring space
+    size_t ws_max_send = 1024 * 1024;               // Per WebSocket client
+    size_t cli_in_msg_size = 64 * 1024;             // Initial module receive buffer
+    int cli_dispatch_budget = 16;                   // Module messages per main loop iteration
+    size_t cli_out_queue_bytes = 256 * 1024;        // Waiting for a busy module
+
+    // Returns false if the file exists but can't be used. The defaults stay
+    // in effect then.
+    bool load(const char *path);
+};